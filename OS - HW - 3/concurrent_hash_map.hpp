@@ -0,0 +1,309 @@
+/*
+ * concurrent_hash_map.hpp
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Header only C++ front-end with the bucket design of hashtable.c:
+ * chained buckets, a sentinel lock in front of every bucket and a lock
+ * per node taken hand-over-hand. Values are stored inside the nodes,
+ * the hash and the lock type are template parameters so both get
+ * inlined.
+ */
+
+#ifndef CONCURRENT_HASH_MAP_HPP_
+#define CONCURRENT_HASH_MAP_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace hashtable {
+
+//-----------------------------------------------------//
+//Lock policies:
+
+/* std::mutex per node */
+struct MutexLockPolicy {
+	typedef std::mutex lock_type;
+};
+
+/* test-and-test-and-set spin lock, one byte per node */
+struct SpinLockPolicy {
+	class lock_type {
+	public:
+		void lock() {
+			while (locked.exchange(true, std::memory_order_acquire)) {
+				while (locked.load(std::memory_order_relaxed)) {
+				}
+			}
+		}
+		bool try_lock() {
+			return !locked.exchange(true, std::memory_order_acquire);
+		}
+		void unlock() {
+			locked.store(false, std::memory_order_release);
+		}
+	private:
+		std::atomic<bool> locked { false };
+	};
+};
+
+/* no locking at all, for maps owned by a single thread */
+struct NoLockPolicy {
+	struct lock_type {
+		void lock() {
+		}
+		bool try_lock() {
+			return true;
+		}
+		void unlock() {
+		}
+	};
+};
+
+//-----------------------------------------------------//
+//Hashes and comparators:
+
+/* splitmix64 finalizer for integer keys */
+template<typename Key, typename Enable = void>
+struct DefaultHash;
+
+template<typename Key>
+struct DefaultHash<Key, typename std::enable_if<std::is_integral<Key>::value>::type> {
+	std::uint64_t operator()(Key key) const {
+		std::uint64_t x = static_cast<std::uint64_t>(key);
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+};
+
+/* FNV-1a for string keys */
+template<>
+struct DefaultHash<std::string> {
+	std::uint64_t operator()(const std::string& key) const {
+		std::uint64_t h = 0xcbf29ce484222325ULL;
+		for (unsigned char c : key) {
+			h = (h ^ c) * 0x100000001b3ULL;
+		}
+		return h;
+	}
+};
+
+template<typename Key>
+struct KeyEqual {
+	bool operator()(const Key& a, const Key& b) const {
+		return a == b;
+	}
+};
+
+/* strings compare their lengths before touching the characters */
+template<>
+struct KeyEqual<std::string> {
+	bool operator()(const std::string& a, const std::string& b) const {
+		return a.size() == b.size()
+				&& std::memcmp(a.data(), b.data(), a.size()) == 0;
+	}
+};
+
+/* keys that are worth comparing the cached hash first */
+template<typename Key>
+struct CompareHashFirst : std::integral_constant<bool,
+		!std::is_arithmetic<Key>::value> {
+};
+
+//-----------------------------------------------------//
+
+template<typename Key, typename Value, typename Hash = DefaultHash<Key>,
+		typename LockPolicy = MutexLockPolicy, typename Equal = KeyEqual<Key> >
+class ConcurrentHashMap {
+	typedef typename LockPolicy::lock_type Lock;
+
+	struct Node {
+		template<typename ... Args>
+		Node(std::uint64_t hash, Key&& key, Args&&... args) :
+				hash(hash), key(std::move(key)), value(
+						std::forward<Args>(args)...), next(nullptr) {
+		}
+		Lock lock;
+		std::uint64_t hash;
+		Key key;
+		Value value;
+		Node* next;
+	};
+
+	struct Bucket {
+		Lock lock; //sentinel in front of the first node
+		Node* head = nullptr;
+		std::atomic<int> size { 0 };
+	};
+
+	/*
+	 * Result of a hand-over-hand walk: the lock guarding *link is held,
+	 * node is the locked node with the key or nullptr at the tail
+	 */
+	struct Position {
+		Lock* held;
+		Node** link;
+		Node* node;
+	};
+
+public:
+	explicit ConcurrentHashMap(std::size_t buckets) :
+			mask(round_up(buckets) - 1), buckets(new Bucket[mask + 1]) {
+	}
+
+	~ConcurrentHashMap() {
+		for (std::size_t i = 0; i <= mask; ++i) {
+			Node* node = buckets[i].head;
+			while (node) {
+				Node* next = node->next;
+				delete node;
+				node = next;
+			}
+		}
+		delete[] buckets;
+	}
+
+	ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+	ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+	/* returns true if inserted, false if the key was already there */
+	bool insert(const Key& key, const Value& value) {
+		return emplace(key, value);
+	}
+
+	bool insert(const Key& key, Value&& value) {
+		return emplace(key, std::move(value));
+	}
+
+	/*
+	 * constructs the value inside the node, only if the key is new.
+	 * The args are left untouched otherwise, so owning pointers must
+	 * come wrapped to be released.
+	 */
+	template<typename ... Args>
+	bool emplace(Key key, Args&&... args) {
+		std::uint64_t h = hasher(key);
+		Bucket& bucket = bucket_of(h);
+		Position pos = find(bucket, h, key);
+		if (pos.node) {
+			pos.held->unlock();
+			pos.node->lock.unlock();
+			return false;
+		}
+		*pos.link = new Node(h, std::move(key), std::forward<Args>(args)...);
+		bucket.size.fetch_add(1, std::memory_order_relaxed);
+		pos.held->unlock();
+		return true;
+	}
+
+	bool contains(const Key& key) {
+		return compute(key, [](Value&) {
+		});
+	}
+
+	bool update(const Key& key, Value value) {
+		return compute(key, [&value](Value& v) {
+			v = std::move(value);
+		});
+	}
+
+	/* copies the value out, returns false if the key is missing */
+	bool get(const Key& key, Value& out) {
+		return compute(key, [&out](Value& v) {
+			out = v;
+		});
+	}
+
+	/* calls f(value) under the node lock, returns false if the key is missing */
+	template<typename F>
+	bool compute(const Key& key, F&& f) {
+		std::uint64_t h = hasher(key);
+		Position pos = find(bucket_of(h), h, key);
+		pos.held->unlock();
+		if (!pos.node)
+			return false;
+		f(pos.node->value);
+		pos.node->lock.unlock();
+		return true;
+	}
+
+	bool remove(const Key& key) {
+		std::uint64_t h = hasher(key);
+		Bucket& bucket = bucket_of(h);
+		Position pos = find(bucket, h, key);
+		if (!pos.node) {
+			pos.held->unlock();
+			return false;
+		}
+		*pos.link = pos.node->next;
+		bucket.size.fetch_sub(1, std::memory_order_relaxed);
+		pos.held->unlock();
+		pos.node->lock.unlock();
+		delete pos.node;
+		return true;
+	}
+
+	std::size_t bucket_count() const {
+		return mask + 1;
+	}
+
+	int bucket_size(std::size_t bucket) const {
+		if (bucket > mask)
+			return -1;
+		return buckets[bucket].size.load(std::memory_order_relaxed);
+	}
+
+private:
+	static std::size_t round_up(std::size_t n) {
+		std::size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+	Bucket& bucket_of(std::uint64_t h) {
+		//the high bits of the hash are the best mixed ones
+		return buckets[(h ^ (h >> 32)) & mask];
+	}
+
+	bool same(const Node* node, std::uint64_t h, const Key& key) const {
+		if (CompareHashFirst<Key>::value && node->hash != h)
+			return false;
+		return equal(node->key, key);
+	}
+
+	Position find(Bucket& bucket, std::uint64_t h, const Key& key) {
+		Lock* prev = &bucket.lock;
+		Node** link = &bucket.head;
+		prev->lock();
+		Node* curr = *link;
+		while (curr) {
+			curr->lock.lock();
+			if (same(curr, h, key))
+				break;
+			prev->unlock();
+			prev = &curr->lock;
+			link = &curr->next;
+			curr = curr->next;
+		}
+		return Position { prev, link, curr };
+	}
+
+	Hash hasher;
+	Equal equal;
+	std::size_t mask;
+	Bucket* buckets;
+};
+
+} /* namespace hashtable */
+
+#endif /* CONCURRENT_HASH_MAP_HPP_ */
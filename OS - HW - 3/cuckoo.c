@@ -0,0 +1,553 @@
+/*
+ * cuckoo.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sched.h>
+
+#include "cuckoo.h"
+
+#define CUCKOO_SLOTS 4
+#define CUCKOO_STRIPES 1024 //power of two
+#define CUCKOO_MAX_PATH 128
+#define CUCKOO_PATH_TRIES 8
+#define CUCKOO_MAX_KICKS 512
+
+typedef struct cuckoo_bucket_t {
+	int keys[CUCKOO_SLOTS];
+	void* values[CUCKOO_SLOTS];
+	unsigned int occupied; //bit per slot
+} cuckoo_bucket_t;
+
+/*
+ * The buckets, replaced by a bigger array when the table grows.
+ * Replaced arrays are kept until the table is freed since optimistic
+ * readers may still be reading them.
+ */
+typedef struct cuckoo_array_t {
+	int nr_buckets;
+	cuckoo_bucket_t* buckets;
+	struct cuckoo_array_t* retired;
+}* Array;
+
+typedef struct stripe_t {
+	pthread_mutex_t lock;
+	unsigned int version; //odd while a bucket of the stripe is being changed
+} __attribute__((aligned(64))) stripe_t;
+
+struct cuckoo_t {
+	Array array;
+	unsigned int epoch; //bumped every time the array is replaced
+	pthread_rwlock_t grow_lock; //shared by writers, exclusive for displacement and growing
+	stripe_t stripes[CUCKOO_STRIPES];
+	int (*hash)(int, int);
+	uint64_t seed;
+	unsigned int rand_state; //only used with the grow lock held exclusively
+};
+
+/*
+ * Position of a key: its two buckets and their stripes
+ */
+typedef struct cuckoo_pos_t {
+	Array array;
+	int b1, b2;
+	int s1, s2;
+} cuckoo_pos_t;
+
+/*
+ * One move of a displacement path: the key in bucket/slot moves to
+ * its other bucket
+ */
+typedef struct cuckoo_step_t {
+	int bucket, slot, key;
+} cuckoo_step_t;
+
+//-----------------------------------------------------//
+//Auxiliary functions:
+
+static inline uint32_t mix(uint64_t seed, int key) {
+	uint64_t x = (uint32_t) key ^ seed;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (uint32_t) ((x ^ (x >> 31)) >> 32);
+}
+
+static inline int range(uint32_t hash, int buckets) {
+	return (int) (((uint64_t) hash * (uint32_t) buckets) >> 32);
+}
+
+/*
+ * Auxiliary function:
+ * first bucket of the key - the user hash when there is one
+ */
+static int primary(cuckoo_t* c, Array a, int key) {
+	if (!c->hash)
+		return range(mix(c->seed, key), a->nr_buckets);
+	int bucket = c->hash(a->nr_buckets, key);
+	if (bucket < 0 || bucket >= a->nr_buckets)
+		return -1;
+	return bucket;
+}
+
+static int alternate(cuckoo_t* c, Array a, int key) {
+	return range(mix(~c->seed, key), a->nr_buckets);
+}
+
+static Array array_alloc(int buckets) {
+	Array a = malloc(sizeof(*a));
+	if (!a)
+		return NULL;
+	if ((a->buckets = calloc(buckets, sizeof(cuckoo_bucket_t))) == NULL) {
+		free(a);
+		return NULL;
+	}
+	a->nr_buckets = buckets;
+	a->retired = NULL;
+	return a;
+}
+
+static void array_free(Array a) {
+	while (a) {
+		Array retired = a->retired;
+		free(a->buckets);
+		free(a);
+		a = retired;
+	}
+}
+
+/*
+ * Auxiliary function:
+ * slot of the key in the bucket, -1 if it is not there.
+ * safe to call without locks, the caller validates the stripe version.
+ */
+static int slot_find(cuckoo_bucket_t* bucket, int key) {
+	unsigned int occupied = __atomic_load_n(&bucket->occupied, __ATOMIC_RELAXED);
+	for (int i = 0; i < CUCKOO_SLOTS; ++i) {
+		if ((occupied & (1u << i))
+				&& __atomic_load_n(&bucket->keys[i], __ATOMIC_RELAXED) == key)
+			return i;
+	}
+	return -1;
+}
+
+static int slot_free(cuckoo_bucket_t* bucket) {
+	for (int i = 0; i < CUCKOO_SLOTS; ++i) {
+		if (!(bucket->occupied & (1u << i)))
+			return i;
+	}
+	return -1;
+}
+
+static void slot_set(cuckoo_bucket_t* bucket, int slot, int key, void* value) {
+	__atomic_store_n(&bucket->keys[slot], key, __ATOMIC_RELAXED);
+	__atomic_store_n(&bucket->values[slot], value, __ATOMIC_RELAXED);
+	__atomic_store_n(&bucket->occupied, bucket->occupied | (1u << slot),
+			__ATOMIC_RELAXED);
+}
+
+static void slot_clear(cuckoo_bucket_t* bucket, int slot) {
+	__atomic_store_n(&bucket->occupied, bucket->occupied & ~(1u << slot),
+			__ATOMIC_RELAXED);
+}
+
+/*
+ * Auxiliary functions:
+ * seqlock style versioning of the stripes of two buckets
+ */
+static void write_begin(cuckoo_t* c, int s1, int s2) {
+	__atomic_store_n(&c->stripes[s1].version, c->stripes[s1].version + 1,
+			__ATOMIC_RELAXED);
+	if (s2 != s1)
+		__atomic_store_n(&c->stripes[s2].version, c->stripes[s2].version + 1,
+				__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(cuckoo_t* c, int s1, int s2) {
+	__atomic_store_n(&c->stripes[s1].version, c->stripes[s1].version + 1,
+			__ATOMIC_RELEASE);
+	if (s2 != s1)
+		__atomic_store_n(&c->stripes[s2].version, c->stripes[s2].version + 1,
+				__ATOMIC_RELEASE);
+}
+
+static int stripe_of(int bucket) {
+	return bucket & (CUCKOO_STRIPES - 1);
+}
+
+/*
+ * Auxiliary function:
+ * finds the buckets of the key, -1 if the user hash is out of range
+ */
+static int position(cuckoo_t* c, Array a, int key, cuckoo_pos_t* pos) {
+	pos->array = a;
+	pos->b1 = primary(c, a, key);
+	if (pos->b1 < 0)
+		return -1;
+	pos->b2 = alternate(c, a, key);
+	pos->s1 = stripe_of(pos->b1);
+	pos->s2 = stripe_of(pos->b2);
+	return 0;
+}
+
+/*
+ * Auxiliary function:
+ * takes the locks needed to change the buckets of the key
+ */
+static int writer_enter(cuckoo_t* c, int key, cuckoo_pos_t* pos) {
+	pthread_rwlock_rdlock(&c->grow_lock);
+	if (position(c, c->array, key, pos) < 0) {
+		pthread_rwlock_unlock(&c->grow_lock);
+		return -1;
+	}
+	int first = pos->s1 < pos->s2 ? pos->s1 : pos->s2;
+	int second = pos->s1 < pos->s2 ? pos->s2 : pos->s1;
+	pthread_mutex_lock(&c->stripes[first].lock);
+	if (second != first)
+		pthread_mutex_lock(&c->stripes[second].lock);
+	return 0;
+}
+
+static void writer_exit(cuckoo_t* c, cuckoo_pos_t* pos) {
+	pthread_mutex_unlock(&c->stripes[pos->s1].lock);
+	if (pos->s2 != pos->s1)
+		pthread_mutex_unlock(&c->stripes[pos->s2].lock);
+	pthread_rwlock_unlock(&c->grow_lock);
+}
+
+/*
+ * Auxiliary function:
+ * finds the key in its two buckets, returns its bucket (and slot) or -1
+ */
+static int pos_find(cuckoo_pos_t* pos, int key, int* slot) {
+	if ((*slot = slot_find(&pos->array->buckets[pos->b1], key)) >= 0)
+		return pos->b1;
+	if ((*slot = slot_find(&pos->array->buckets[pos->b2], key)) >= 0)
+		return pos->b2;
+	return -1;
+}
+
+/*
+ * Auxiliary function:
+ * optimistic lookup, never blocks on the stripe locks.
+ * returns 1 if the key is in the table, 0 if not, -1 on a bad hash.
+ */
+static int cuckoo_lookup(cuckoo_t* c, int key) {
+	for (;;) {
+		unsigned int epoch = __atomic_load_n(&c->epoch, __ATOMIC_ACQUIRE);
+		Array a = __atomic_load_n(&c->array, __ATOMIC_ACQUIRE);
+		cuckoo_pos_t pos;
+		if (position(c, a, key, &pos) < 0)
+			return -1;
+
+		unsigned int v1 = __atomic_load_n(&c->stripes[pos.s1].version,
+				__ATOMIC_ACQUIRE);
+		unsigned int v2 = __atomic_load_n(&c->stripes[pos.s2].version,
+				__ATOMIC_ACQUIRE);
+		if ((v1 | v2) & 1) {
+			sched_yield();
+			continue;
+		}
+		int slot;
+		bool found = pos_find(&pos, key, &slot) >= 0;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&c->stripes[pos.s1].version, __ATOMIC_RELAXED) == v1
+				&& __atomic_load_n(&c->stripes[pos.s2].version,
+						__ATOMIC_RELAXED) == v2
+				&& __atomic_load_n(&c->epoch, __ATOMIC_RELAXED) == epoch)
+			return found ? 1 : 0;
+	}
+}
+
+/*
+ * Auxiliary function:
+ * moves a key between two slots, readers see it in at least one of them.
+ * called with the grow lock held exclusively.
+ */
+static void slot_move(cuckoo_t* c, Array a, int from, int from_slot, int to,
+		int to_slot) {
+	cuckoo_bucket_t* src = &a->buckets[from];
+	write_begin(c, stripe_of(from), stripe_of(to));
+	slot_set(&a->buckets[to], to_slot, src->keys[from_slot],
+			src->values[from_slot]);
+	slot_clear(src, from_slot);
+	write_end(c, stripe_of(from), stripe_of(to));
+}
+
+/*
+ * Auxiliary function:
+ * frees a slot in one of the buckets of the key by moving other keys
+ * to their alternate buckets, last move first, so no key is ever missing.
+ * called with the grow lock held exclusively.
+ */
+static bool make_room(cuckoo_t* c, int key, int* bucket, int* slot) {
+	Array a = c->array;
+	cuckoo_step_t path[CUCKOO_MAX_PATH];
+
+	for (int try = 0; try < CUCKOO_PATH_TRIES; ++try) {
+		int b = (try % 2) ? alternate(c, a, key) : primary(c, a, key);
+		for (int depth = 0; depth < CUCKOO_MAX_PATH; ++depth) {
+			int s = rand_r(&c->rand_state) % CUCKOO_SLOTS;
+			int victim = a->buckets[b].keys[s];
+			int p = primary(c, a, victim);
+			int alt = (b == p) ? alternate(c, a, victim) : p;
+			path[depth] = (cuckoo_step_t ) { b, s, victim };
+
+			int free_slot = slot_free(&a->buckets[alt]);
+			if (free_slot < 0) {
+				b = alt;
+				continue;
+			}
+
+			//walk the path back, every move frees the slot of the previous one
+			int to = alt, to_slot = free_slot;
+			int i;
+			for (i = depth; i >= 0; --i) {
+				cuckoo_bucket_t* src = &a->buckets[path[i].bucket];
+				//the path crossed itself
+				if (slot_find(src, path[i].key) != path[i].slot
+						|| (a->buckets[to].occupied & (1u << to_slot)))
+					break;
+				slot_move(c, a, path[i].bucket, path[i].slot, to, to_slot);
+				to = path[i].bucket;
+				to_slot = path[i].slot;
+			}
+			if (i < 0) {
+				*bucket = to;
+				*slot = to_slot;
+				return true;
+			}
+			break;
+		}
+	}
+	return false;
+}
+
+/*
+ * Auxiliary function:
+ * inserts into an array that no other thread can see yet
+ */
+static bool private_insert(cuckoo_t* c, Array a, int key, void* value) {
+	for (int kick = 0; kick < CUCKOO_MAX_KICKS; ++kick) {
+		int b1 = primary(c, a, key), b2 = alternate(c, a, key);
+		int s;
+		if ((s = slot_free(&a->buckets[b1])) >= 0) {
+			slot_set(&a->buckets[b1], s, key, value);
+			return true;
+		}
+		if ((s = slot_free(&a->buckets[b2])) >= 0) {
+			slot_set(&a->buckets[b2], s, key, value);
+			return true;
+		}
+		//evict a random victim and carry it on
+		int b = (kick % 2) ? b2 : b1;
+		s = rand_r(&c->rand_state) % CUCKOO_SLOTS;
+		int victim = a->buckets[b].keys[s];
+		void* victim_value = a->buckets[b].values[s];
+		a->buckets[b].keys[s] = key;
+		a->buckets[b].values[s] = value;
+		key = victim;
+		value = victim_value;
+	}
+	return false;
+}
+
+/*
+ * Auxiliary function:
+ * replaces the array with one at least twice as big.
+ * called with the grow lock held exclusively.
+ */
+static int grow(cuckoo_t* c) {
+	Array old = c->array;
+	for (int buckets = old->nr_buckets * 2; buckets > 0; buckets *= 2) {
+		Array a = array_alloc(buckets);
+		if (!a)
+			return -1;
+
+		bool ok = true;
+		for (int b = 0; ok && b < old->nr_buckets; ++b) {
+			for (int s = 0; ok && s < CUCKOO_SLOTS; ++s) {
+				if (old->buckets[b].occupied & (1u << s))
+					ok = private_insert(c, a, old->buckets[b].keys[s],
+							old->buckets[b].values[s]);
+			}
+		}
+		if (!ok) {
+			array_free(a);
+			continue;
+		}
+
+		a->retired = old;
+		__atomic_store_n(&c->array, a, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&c->epoch, 1, __ATOMIC_RELEASE);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Auxiliary function:
+ * insert when both buckets of the key are full
+ */
+static int insert_slow(cuckoo_t* c, int key, void* value) {
+	pthread_rwlock_wrlock(&c->grow_lock);
+	int res = 1;
+	cuckoo_pos_t pos;
+	int bucket, slot;
+
+	position(c, c->array, key, &pos);
+	if (pos_find(&pos, key, &slot) >= 0) {
+		res = 0;
+	} else {
+		while (!make_room(c, key, &bucket, &slot)) {
+			if (grow(c) < 0) {
+				res = -1;
+				break;
+			}
+		}
+		if (res == 1) {
+			write_begin(c, stripe_of(bucket), stripe_of(bucket));
+			slot_set(&c->array->buckets[bucket], slot, key, value);
+			write_end(c, stripe_of(bucket), stripe_of(bucket));
+		}
+	}
+	pthread_rwlock_unlock(&c->grow_lock);
+	return res;
+}
+
+static int cuckoo_insert(cuckoo_t* c, int key, void* value) {
+	cuckoo_pos_t pos;
+	int slot, bucket;
+	if (writer_enter(c, key, &pos) < 0)
+		return -1;
+	if (pos_find(&pos, key, &slot) >= 0) {
+		writer_exit(c, &pos);
+		return 0;
+	}
+
+	bucket = pos.b1;
+	if ((slot = slot_free(&pos.array->buckets[bucket])) < 0) {
+		bucket = pos.b2;
+		slot = slot_free(&pos.array->buckets[bucket]);
+	}
+	if (slot < 0) {
+		writer_exit(c, &pos);
+		return insert_slow(c, key, value);
+	}
+	write_begin(c, pos.s1, pos.s2);
+	slot_set(&pos.array->buckets[bucket], slot, key, value);
+	write_end(c, pos.s1, pos.s2);
+	writer_exit(c, &pos);
+	return 1;
+}
+
+/*
+ * Auxiliary function:
+ * REMOVE, UPDATE and COMPUTE: a change to one slot under the stripe locks
+ */
+static int cuckoo_modify(cuckoo_t* c, op_t* op) {
+	cuckoo_pos_t pos;
+	int slot;
+	if (writer_enter(c, op->key, &pos) < 0)
+		return -1;
+	int bucket = pos_find(&pos, op->key, &slot);
+	if (bucket < 0) {
+		writer_exit(c, &pos);
+		return 0;
+	}
+
+	cuckoo_bucket_t* b = &pos.array->buckets[bucket];
+	switch (op->op) {
+	case REMOVE:
+		write_begin(c, pos.s1, pos.s2);
+		slot_clear(b, slot);
+		write_end(c, pos.s1, pos.s2);
+		break;
+	case UPDATE:
+		__atomic_store_n(&b->values[slot], op->val, __ATOMIC_RELAXED);
+		break;
+	case COMPUTE:
+		op->val = op->compute_func(b->values[slot]);
+		break;
+	case GET:
+		*(void**) op->val = b->values[slot];
+		break;
+	default:
+		break;
+	}
+	writer_exit(c, &pos);
+	return 1;
+}
+
+//-----------------------------------------------------//
+
+cuckoo_t* cuckoo_alloc(int buckets, int (*hash)(int, int), uint64_t seed) {
+	cuckoo_t* c;
+	if (buckets < 1)
+		return NULL;
+	if ((c = malloc(sizeof(*c))) == NULL)
+		return NULL;
+	if ((c->array = array_alloc(buckets)) == NULL) {
+		free(c);
+		return NULL;
+	}
+	c->epoch = 0;
+	c->hash = hash;
+	c->seed = seed;
+	c->rand_state = (unsigned int) seed;
+	pthread_rwlock_init(&c->grow_lock, NULL);
+	for (int i = 0; i < CUCKOO_STRIPES; ++i) {
+		pthread_mutex_init(&c->stripes[i].lock, NULL);
+		c->stripes[i].version = 0;
+	}
+	return c;
+}
+
+void cuckoo_free(cuckoo_t* c) {
+	if (!c)
+		return;
+	for (int i = 0; i < CUCKOO_STRIPES; ++i) {
+		pthread_mutex_destroy(&c->stripes[i].lock);
+	}
+	pthread_rwlock_destroy(&c->grow_lock);
+	array_free(c->array);
+	free(c);
+}
+
+int cuckoo_execute(cuckoo_t* c, op_t* op) {
+	switch (op->op) {
+	case INSERT:
+		op->result = cuckoo_insert(c, op->key, op->val);
+		break;
+	case CONTAINS:
+		op->result = cuckoo_lookup(c, op->key);
+		break;
+	case REMOVE:
+	case UPDATE:
+	case COMPUTE:
+	case GET:
+		op->result = cuckoo_modify(c, op);
+		break;
+	default:
+		op->result = -1;
+	}
+	return op->result;
+}
+
+int cuckoo_bucket(cuckoo_t* c, int key) {
+	return primary(c, __atomic_load_n(&c->array, __ATOMIC_ACQUIRE), key);
+}
+
+int cuckoo_bucketsize(cuckoo_t* c, int bucket) {
+	Array a = __atomic_load_n(&c->array, __ATOMIC_ACQUIRE);
+	if (bucket < 0 || bucket >= a->nr_buckets)
+		return -1;
+	return __builtin_popcount(
+			__atomic_load_n(&a->buckets[bucket].occupied, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,30 @@
+/*
+ * cuckoo.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Bucketized cuckoo storage engine behind HASH_CUCKOO tables.
+ * Every key lives in one of two buckets of 4 slots, so a lookup probes
+ * at most two buckets. Writers lock striped bucket locks, readers are
+ * optimistic and retry when the version of a stripe they read changed.
+ */
+
+#ifndef CUCKOO_H_
+#define CUCKOO_H_
+
+#include <stdint.h>
+
+#include "hashtable.h"
+
+struct cuckoo_t;
+typedef struct cuckoo_t cuckoo_t;
+
+cuckoo_t* cuckoo_alloc(int buckets, int (*hash)(int, int), uint64_t seed);
+void cuckoo_free(cuckoo_t* cuckoo);
+/* executes one op with the hash_* semantics, returns op->result */
+int cuckoo_execute(cuckoo_t* cuckoo, op_t* op);
+int cuckoo_bucket(cuckoo_t* cuckoo, int key);
+int cuckoo_bucketsize(cuckoo_t* cuckoo, int bucket);
+
+#endif /* CUCKOO_H_ */
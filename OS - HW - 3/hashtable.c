@@ -5,143 +5,670 @@
  *      Author: lena
  */
 
+#define _GNU_SOURCE //pthread_rwlock_clockrdlock
 #include <stdlib.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <semaphore.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HASH_HAVE_AVX2
+#endif
 
 #include "hashtable.h"
-
-//#define _GNU_SOURCE
+#include "lock.h"
+#include "cuckoo.h"
+#include "shmtable.h"
+#include "numa.h"
 
 typedef struct node_t {
-	pthread_mutex_t mutex;
+	lock_t lock;
 	int key;
-	void* value;
+	void* value; //points to data when the table stores values inline
 	struct node_t* next;
+	int referenced; //CLOCK second chance bit, set by lookups
+	uint8_t arena; //what numa_block_free needs, 0 if malloced
+	uint16_t hits; //HASH_TRANSPOSE: lookups of the entry, halved when it saturates
+	uint64_t expires; //CLOCK_MONOTONIC deadline in ns, 0 for never
+	int tombstone; //removed, waiting for the compactor to unlink it
+	_Alignas(8) unsigned char data[];
 }* Node;
 
 typedef int (*Hash)(int, int);
+typedef void (*HashMany)(int, const int*, int*, int);
+
+typedef op_t* Op;
+
+#define SWEEP_STEP 64 //buckets the sweeper walks per step, at least
+#define SWEEP_PASSES 16 //steps the sweeper takes to walk every bucket, at most
+#define PASS_CHUNK 16 //buckets a worker of a parallel pass claims at once
+#define FREE_THREAD_ENTRIES (1 << 16) //entries worth one more teardown thread
+#define FEED_IDLE ULLONG_MAX
+#define CHECKPOINT_MAGIC 0x48434b31 //"HCK1"
+#define CHECKPOINT_BUFFER (64 * 1024)
+#define DEADLINE_TRY 1 //a deadline already past: only try the locks
+#define VALIDATE_NO_MEMORY (-2) //transaction_validate couldn't check the ops
+#define STREAM_QUEUE 16 //ops of a node waiting for one of its stream threads
+#define HOP_STRIPES 64 //HASH_HOP_STATS counters, the threads are spread over them
+#define BLOOM_CELLS 16 //HASH_BLOOM: 4 bit counters in the word of a bucket
+#define BLOOM_STUCK 15 //a counter that got there can't tell how many keys it had
+
+/*
+ * Flat combining publication record:
+ * lives on the stack of the thread that published it until done is set
+ */
+typedef struct fc_record_t {
+	Op op;
+	int done;
+	struct fc_record_t* next;
+}* FcRecord;
+
+/*
+ * Change feed ring of one writing thread: the writer only moves tail,
+ * the reader only moves head. Drained rings of exited threads are reused.
+ */
+typedef struct feed_ring_t {
+	_Alignas(64) unsigned long long head;
+	_Alignas(64) unsigned long long tail;
+	unsigned long long pending; //lower bound of the seq being appended, FEED_IDLE otherwise
+	int in_use;
+	struct feed_ring_t* next;
+	hash_change_t records[];
+}* FeedRing;
+
+typedef struct feed_t {
+	unsigned long long seq; //next sequence number
+	unsigned long long expected; //next sequence number the reader hands out
+	int size; //records per ring, power of two
+	FeedRing rings; //only ever grows, new rings are pushed at the head
+	pthread_key_t ring_key; //the ring of the calling thread
+	pthread_mutex_t read_lock;
+}* Feed;
+
+/*
+ * Hop counters of HASH_HOP_STATS, one cache line each
+ */
+typedef struct hop_stripe_t {
+	_Alignas(64) unsigned long long lookups;
+	unsigned long long hops;
+}* HopStripe;
 
 typedef struct hashtable_t {
 	int nr_buckets, nr_threads, stopped;
-	Hash hash_func;
+	int flags;
+	int value_size; //bytes stored in the node, 0 for void* values
+	int capacity; //max entries before CLOCK eviction, 0 for unbounded
+	unsigned int clock_hand; //next bucket the eviction looks at
+	void (*evict_func)(int, void*);
+	int sweep_ms; //pause of the sweeper
+	bool sweeping; //the sweeper thread was started
+	pthread_t sweeper;
+	pthread_mutex_t sweep_lock;
+	pthread_cond_t sweep_condition; //wakes the sweeper up on hash_stop
+	Hash hash_func; //NULL for the built-in seeded hash
+	HashMany hash_many; //optional batch version of hash_func
+	uint64_t seed;
+	int shift; //64 - log2(nr_buckets) with HASH_POW2_BUCKETS, 0 otherwise
+	int nr_entries;
+	int max_chain;
+	int inserts_since_reseed;
+	int reseed_pending;
+	int nr_reseeds;
+	pthread_rwlock_t resize_lock; //shared by ops, exclusive by reseed, only with HASH_AUTO_RESEED
 	Node* table;
-	pthread_mutex_t* empty_list_locks; //locks only for dummy node, not entire list
+	lock_t* bucket_locks; //sentinel lock in front of the first node of each bucket
 	int* buckets_sizes;
-	pthread_mutex_t* sizes_locks;
+	lock_t* sizes_locks;
+	FcRecord* fc_pending; //per bucket publication lists, only with HASH_FLAT_COMBINING
+	lock_t* fc_locks; //per bucket combiner locks
+	pthread_rwlock_t* bucket_rw; //shared by ops, exclusive by transactions, only with HASH_TRANSACTIONS
+	cuckoo_t* cuckoo; //the buckets when the table uses the cuckoo engine
+	shmtable_t* shm; //the buckets when the table lives in shared memory
+	numa_t* numa; //HASH_NUMA or HASH_HUGE_PAGES: the bucket arrays and node arenas
+	HopStripe hop_stats; //only with HASH_HOP_STATS
+	uint64_t* bloom; //per bucket counting filter, only with HASH_BLOOM
+	Feed feed; //only with HASH_CHANGE_FEED
+	unsigned char* dirty; //per bucket, changed since the last checkpoint, only with HASH_CHECKPOINT
+	int checkpoint_full; //the next checkpoint writes every bucket
+	uint64_t checkpoints; //generation of the last checkpoint
+	pthread_mutex_t checkpoint_lock;
 	pthread_mutex_t empty_threads_list_lock;
 	pthread_mutex_t nr_threads_lock;
 	pthread_mutex_t stop_lock;
 	pthread_cond_t stop_condition;
 }* Hashtable;
 
-typedef op_t* Op;
-
 //-----------------------------------------------------//
 //Auxiliary functions:
 
 /*
  * Auxiliary function:
- * allocate new pair of key-value
+ * allocate new pair of key-value.
+ * with inline values the value is copied into the node.
+ * HASH_NUMA and HASH_HUGE_PAGES tables take it from an arena of the home
+ * node of the bucket.
  */
-Node node_alloc(int key, void* value) {
+Node node_alloc(Hashtable table, int bucket, int key, void* value) {
 
 	Node newpair;
-	if ((newpair = malloc(sizeof(*newpair))) == NULL) {
+	uint8_t arena = 0;
+	if (table->numa)
+		newpair = numa_block_alloc(table->numa,
+				numa_home(table->numa, bucket), &arena);
+	else
+		newpair = malloc(sizeof(*newpair) + table->value_size);
+	if (newpair == NULL) {
 		return NULL;
 	}
-	pthread_mutexattr_t attr;
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK_NP);
-	pthread_mutex_init(&newpair->mutex, &attr);
+	newpair->arena = arena;
+	lock_init(&newpair->lock);
 	newpair->key = key;
 	newpair->value = value;
 	newpair->next = NULL;
+	newpair->referenced = 0; //earns its second chance on the first hit
+	newpair->hits = 0;
+	newpair->expires = 0;
+	newpair->tombstone = 0;
+	if (table->value_size) {
+		newpair->value = newpair->data;
+		if (value)
+			memcpy(newpair->data, value, table->value_size);
+		else
+			memset(newpair->data, 0, table->value_size);
+	}
 
 	return newpair;
 }
 
+/*
+ * Auxiliary function:
+ * frees a node that is no longer linked to any bucket
+ */
+static void node_free(Hashtable table, Node node) {
+	if (node->arena)
+		numa_block_free(table->numa, node, node->arena);
+	else
+		free(node);
+}
+
 /*
  *  Auxiliary function:
- *  destroys list of node by the head
+ *  destroys list of node by the head, returns how many
+ */
+long list_destroy(Hashtable table, Node node) {
+	long freed = 0;
+	while (node) {
+		Node next = node->next;
+		node_free(table, node);
+		node = next;
+		freed++;
+	}
+	return freed;
+}
+
+static uint64_t clock_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//set while the thread runs a transaction: all of its ops see this time
+static __thread uint64_t transaction_now;
+
+/*
+ * Auxiliary function:
+ * the time the ttls are checked and counted from
+ */
+static inline uint64_t ttl_now() {
+	return transaction_now ? transaction_now : clock_ns();
+}
+
+/*
+ * Auxiliary function:
+ * a node that is still linked but no longer in the table: a tombstone,
+ * or expired at now (pass 0 to check tombstones only)
+ */
+static inline bool node_dead(Node node, uint64_t now) {
+	return node->tombstone || (node->expires && node->expires <= now);
+}
+
+static void feed_ring_release(void* ring) {
+	__atomic_store_n(&((FeedRing) ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Auxiliary function:
+ * the ring of the calling thread, an abandoned one or a new one.
+ * NULL if there is no memory for it.
+ */
+static FeedRing feed_ring(Feed feed) {
+	FeedRing ring = pthread_getspecific(feed->ring_key);
+	if (ring)
+		return ring;
+
+	for (ring = __atomic_load_n(&feed->rings, __ATOMIC_ACQUIRE); ring;
+			ring = ring->next) {
+		//only once the reader drained what the exited thread left there
+		int free_ring = 0;
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+				== __atomic_load_n(&ring->tail, __ATOMIC_RELAXED)
+				&& __atomic_compare_exchange_n(&ring->in_use, &free_ring, 1,
+						false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+	if (!ring) {
+		if (posix_memalign((void**) &ring, 64,
+				sizeof(*ring) + sizeof(hash_change_t) * feed->size) != 0)
+			return NULL;
+		ring->head = ring->tail = 0;
+		ring->pending = FEED_IDLE;
+		ring->in_use = 1;
+		ring->next = __atomic_load_n(&feed->rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&feed->rings, &ring->next, ring,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		}
+	}
+	pthread_setspecific(feed->ring_key, ring);
+	return ring;
+}
+
+/*
+ * Auxiliary function:
+ * appends a change to the ring of the calling thread. called with the lock
+ * that ordered the change held, so sequence numbers follow the apply order.
+ * pending tells the reader a seq at least that big may still show up here.
  */
-void list_destroy(Node node) {
-	if (!node)
+static void feed_append(Feed feed, int op, int key, void* val) {
+	FeedRing ring = feed_ring(feed);
+	if (!ring) {
+		//the reader sees the gap as a dropped change
+		__atomic_fetch_add(&feed->seq, 1, __ATOMIC_SEQ_CST);
 		return;
-	list_destroy(node->next);
-	pthread_mutex_destroy(&node->mutex);
-	free(node);
+	}
+	__atomic_store_n(&ring->pending,
+			__atomic_load_n(&feed->seq, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	unsigned long long seq = __atomic_fetch_add(&feed->seq, 1, __ATOMIC_SEQ_CST);
+	unsigned long long tail = ring->tail;
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+			< (unsigned long long) feed->size) {
+		ring->records[tail & (feed->size - 1)] =
+				(hash_change_t) { seq, key, op, val };
+		__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&ring->pending, FEED_IDLE, __ATOMIC_RELEASE);
 }
 
 /*
  * Auxiliary function:
- * adds element to the tail of the list
- * the malloc is outside of this function
+ * records a change of node in the bucket, under the lock that orders it:
+ * the bucket is dirty for the next checkpoint and the change is fed
  */
-int list_add(Node* dest, Node element, pthread_mutex_t *head_mutex) {
-	if (!element)
-		return -1;
+static inline void change_note(Hashtable table, int bucket, int op, Node node) {
+	if (table->dirty && !__atomic_load_n(&table->dirty[bucket], __ATOMIC_RELAXED))
+		__atomic_store_n(&table->dirty[bucket], 1, __ATOMIC_RELEASE);
+	if (table->feed)
+		feed_append(table->feed, op, node->key,
+				(op == REMOVE || table->value_size) ? NULL : node->value);
+}
 
-	Node curr = *dest;
-	//case of empty list, head == NULL
-	if (!curr) {
-		pthread_mutex_lock(head_mutex);
-		*dest = element;
-		pthread_mutex_unlock(head_mutex);
-		return 1;
+/*
+ * Auxiliary function:
+ * takes a lock of a walk: blocks when deadline is 0, only tries it when
+ * it is DEADLINE_TRY and waits until the CLOCK_MONOTONIC time deadline
+ * otherwise. returns false if the lock stayed held
+ */
+static inline bool walk_lock(lock_t* lock, uint64_t deadline) {
+	if (!deadline) {
+		lock_acquire(lock);
+		return true;
 	}
+	if (deadline == DEADLINE_TRY)
+		return lock_try(lock);
+	return lock_acquire_until(lock, deadline);
+}
 
-	Node prev = NULL;
+/*
+ * Auxiliary function:
+ * read locks a rwlock of the table like walk_lock takes a lock
+ */
+static bool walk_rdlock(pthread_rwlock_t* rwlock, uint64_t deadline) {
+	if (!deadline)
+		return pthread_rwlock_rdlock(rwlock) == 0;
+	if (deadline == DEADLINE_TRY)
+		return pthread_rwlock_tryrdlock(rwlock) == 0;
+	struct timespec until = { deadline / 1000000000ULL,
+			deadline % 1000000000ULL };
+	return pthread_rwlock_clockrdlock(rwlock, CLOCK_MONOTONIC, &until) == 0;
+}
+
+/*
+ * Auxiliary function:
+ * counts a walk that found its key after hops nodes
+ */
+static void hops_note(Hashtable table, int hops) {
+	static unsigned int next_stripe;
+	static __thread int stripe = -1;
+	if (stripe < 0)
+		stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED)
+				% HOP_STRIPES;
+	HopStripe stats = &table->hop_stats[stripe];
+	__atomic_add_fetch(&stats->lookups, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats->hops, hops, __ATOMIC_RELAXED);
+}
+
+/*
+ * Auxiliary function:
+ * the two counters of the key in the filter word of its bucket, as shifts.
+ * they are picked by another hash than the bucket, and are never the same
+ */
+static inline void bloom_cells(Hashtable table, int key, int* a, int* b) {
+	uint64_t x = ((uint32_t) key ^ table->seed) * 0xd6e8feb86659fd93ULL;
+	uint32_t hash = x >> 56; //the best mixed bits of the product
+	*a = hash % BLOOM_CELLS;
+	*b = (*a + 1 + (hash >> 4) % (BLOOM_CELLS - 1)) % BLOOM_CELLS;
+	*a *= 4;
+	*b *= 4;
+}
+
+/*
+ * Auxiliary function:
+ * false if the key is surely not in the bucket, without touching a node
+ */
+static inline bool bloom_may_contain(Hashtable table, int bucket, int key) {
+	int a, b;
+	bloom_cells(table, key, &a, &b);
+	uint64_t word = __atomic_load_n(&table->bloom[bucket], __ATOMIC_ACQUIRE);
+	return ((word >> a) & 0xf) && ((word >> b) & 0xf);
+}
+
+/*
+ * Auxiliary function:
+ * counts a key in (delta 1) or out (delta -1) of the filter of its bucket.
+ * a key is counted in before it is linked, so the filter never misses a
+ * key that is in the bucket. Stuck counters stay until the next rehash.
+ */
+static void bloom_add(Hashtable table, int bucket, int key, int delta) {
+	int cells[2];
+	bloom_cells(table, key, &cells[0], &cells[1]);
+	uint64_t old = __atomic_load_n(&table->bloom[bucket], __ATOMIC_RELAXED);
+	uint64_t word;
+	do {
+		word = old;
+		for (int i = 0; i < 2; ++i) {
+			if (((word >> cells[i]) & 0xf) == BLOOM_STUCK)
+				continue;
+			if (delta > 0)
+				word += 1ULL << cells[i];
+			else
+				word -= 1ULL << cells[i];
+		}
+	} while (!__atomic_compare_exchange_n(&table->bloom[bucket], &old, word,
+			false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+/*
+ * Auxiliary function:
+ * walks the bucket hand-over-hand, starting from the bucket lock which
+ * acts as the predecessor of the first node.
+ * On return the lock guarding *link is held (*held) and *link is the link
+ * pointing to the node with the key - that node is returned locked -
+ * or the tail link when the key is not in the bucket (NULL returned).
+ * A dead node with the key is unlinked on the way and handed back in
+ * *dead, to be released with node_reclaim once the locks are dropped.
+ * With a deadline (see walk_lock) the walk may give up on a held lock:
+ * then nothing is held, *held is NULL and NULL is returned.
+ */
+static Node list_find(Hashtable table, int bucket, int key, Node** link,
+		lock_t** held, Node* dead, uint64_t deadline) {
+	lock_t* prev_lock = &table->bucket_locks[bucket];
+	Node* prev_link = &table->table[bucket];
+
+	*dead = NULL;
+	*held = NULL;
+	if (!walk_lock(prev_lock, deadline))
+		return NULL;
+	Node curr = *prev_link;
+	int hops = 0;
 	while (curr) {
-		pthread_mutex_lock(&curr->mutex);
-		if (curr->key == element->key) {
-			if (prev) {
-				pthread_mutex_unlock(&prev->mutex);
-			}
-			pthread_mutex_unlock(&curr->mutex);
-			return 0;
+		if (!walk_lock(&curr->lock, deadline)) {
+			lock_release(prev_lock);
+			return NULL;
 		}
-		if (prev) {
-			pthread_mutex_unlock(&prev->mutex);
+		hops++;
+		if (curr->key == key) {
+			if (!node_dead(curr, curr->expires ? ttl_now() : 0)) {
+				if (table->hop_stats)
+					hops_note(table, hops);
+				break;
+			}
+			//keys are unique, keep walking only to reach the tail
+			*prev_link = curr->next;
+			if (!curr->tombstone)
+				change_note(table, bucket, REMOVE, curr);
+			lock_release(&curr->lock);
+			curr->next = NULL;
+			*dead = curr;
+			curr = *prev_link;
+			continue;
 		}
-		prev = curr;
+		lock_release(prev_lock);
+		prev_lock = &curr->lock;
+		prev_link = &curr->next;
 		curr = curr->next;
+	}
+	*link = prev_link;
+	*held = prev_lock;
+	return curr;
+}
 
+/*
+ * Auxiliary function:
+ * swaps the entries of two locked nodes. the nodes keep their place in
+ * the chain, their lock and their arena
+ */
+static void node_swap(Hashtable table, Node a, Node b) {
+	int key = a->key;
+	a->key = b->key;
+	b->key = key;
+	int referenced = a->referenced;
+	a->referenced = b->referenced;
+	b->referenced = referenced;
+	uint16_t hits = a->hits;
+	a->hits = b->hits;
+	b->hits = hits;
+	uint64_t expires = a->expires;
+	a->expires = b->expires;
+	b->expires = expires;
+	int tombstone = a->tombstone;
+	a->tombstone = b->tombstone;
+	b->tombstone = tombstone;
+	if (!table->value_size) {
+		void* value = a->value;
+		a->value = b->value;
+		b->value = value;
+		return;
+	}
+	unsigned char chunk[64];
+	for (int done = 0; done < table->value_size; done += sizeof(chunk)) {
+		int size = table->value_size - done;
+		if (size > (int) sizeof(chunk))
+			size = sizeof(chunk);
+		memcpy(chunk, a->data + done, size);
+		memcpy(a->data + done, b->data + done, size);
+		memcpy(b->data + done, chunk, size);
 	}
-	prev->next = element;
-	pthread_mutex_unlock(&prev->mutex);
-	return 1;
 }
 
-int list_update(Node head, int key, void* val) {
-	Node curr, prev;
-	curr = head;
-	prev = NULL;
-	if (!head)
-		return 0;
+/*
+ * Auxiliary function:
+ * HASH_TRANSPOSE: the ops that keep the node they found call it with the
+ * lock list_find left held, which is the lock of the node before when
+ * there is one. The entry trades places with the entry before if it was
+ * looked up more often, only the payloads move, so the two locks held
+ * are enough. Releases held and returns the node that has the entry,
+ * still locked.
+ */
+static Node list_promote(Hashtable table, int bucket, lock_t* held,
+		Node curr) {
+	if (!curr || !(table->flags & HASH_TRANSPOSE)) {
+		lock_release(held);
+		return curr;
+	}
+	if (++curr->hits == UINT16_MAX)
+		curr->hits >>= 1;
+	if (held == &table->bucket_locks[bucket]) {
+		lock_release(held);
+		return curr;
+	}
+	Node prev = (Node) ((char*) held - offsetof(struct node_t, lock));
+	if (curr->hits <= prev->hits) {
+		lock_release(held);
+		return curr;
+	}
+	node_swap(table, prev, curr);
+	lock_release(&curr->lock);
+	return prev;
+}
 
-	while (curr) {
-		pthread_mutex_lock(&curr->mutex);
-		if (curr->key == key) {
-			curr->value = val;
-			if (prev) {
-				pthread_mutex_unlock(&prev->mutex);
-			}
-			pthread_mutex_unlock(&curr->mutex);
-			return 1;
-		}
-		if (prev) {
-			pthread_mutex_unlock(&prev->mutex);
+/*
+ * Auxiliary function:
+ * marks a node as recently used for the CLOCK eviction
+ */
+static inline void node_touch(Hashtable table, Node node) {
+	if (table->capacity
+			&& !__atomic_load_n(&node->referenced, __ATOMIC_RELAXED))
+		__atomic_store_n(&node->referenced, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Auxiliary function:
+ * changes the size counter of a bucket
+ */
+static void bucket_size_add(Hashtable table, int bucket, int delta) {
+	lock_acquire(&table->sizes_locks[bucket]);
+	table->buckets_sizes[bucket] += delta;
+	lock_release(&table->sizes_locks[bucket]);
+	__atomic_add_fetch(&table->nr_entries, delta, __ATOMIC_RELAXED);
+}
+
+/*
+ * Auxiliary function:
+ * releases dead nodes that were unlinked, chained by next.
+ * tombstones left the table when they were removed, expired nodes leave
+ * it now.
+ */
+static void node_reclaim(Hashtable table, int bucket, Node dead) {
+	while (dead) {
+		Node next = dead->next;
+		if (!dead->tombstone) {
+			bucket_size_add(table, bucket, -1);
+			if (table->bloom)
+				bloom_add(table, bucket, dead->key, -1);
+			if (table->evict_func)
+				table->evict_func(dead->key, dead->value);
 		}
-		prev = curr;
-		curr = curr->next;
+		node_free(table, dead);
+		dead = next;
+	}
+}
+
+/*
+ * Auxiliary function:
+ * adds element to the tail of the list
+ * the malloc is outside of this function
+ */
+int list_add(Hashtable table, int bucket, Node element, uint64_t deadline) {
+	if (!element)
+		return -1;
 
+	Node* link;
+	lock_t* held;
+	Node dead;
+	Node curr = list_find(table, bucket, element->key, &link, &held, &dead,
+			deadline);
+	if (!held) {
+		node_reclaim(table, bucket, dead);
+		return HASH_BUSY;
 	}
-	pthread_mutex_unlock(&prev->mutex);
-	return 0;
+	if (curr) {
+		lock_release(held);
+		lock_release(&curr->lock);
+		return 0;
+	}
+	if (table->bloom)
+		bloom_add(table, bucket, element->key, 1);
+	*link = element;
+	change_note(table, bucket, INSERT, element);
+	lock_release(held);
+	node_reclaim(table, bucket, dead);
+	return 1;
+}
+
+int list_update(Hashtable table, int bucket, int key, void* val,
+		uint64_t expires, uint64_t deadline) {
+	Node* link;
+	lock_t* held;
+	Node dead;
+	Node curr = list_find(table, bucket, key, &link, &held, &dead, deadline);
+	if (!held) {
+		node_reclaim(table, bucket, dead);
+		return HASH_BUSY;
+	}
+	curr = list_promote(table, bucket, held, curr);
+	if (!curr) {
+		node_reclaim(table, bucket, dead);
+		return 0;
+	}
+	if (expires)
+		curr->expires = expires;
+	if (table->value_size && val)
+		memcpy(curr->value, val, table->value_size);
+	else if (table->value_size)
+		memset(curr->value, 0, table->value_size); //like an insert of NULL
+	else
+		curr->value = val;
+	change_note(table, bucket, UPDATE, curr);
+	lock_release(&curr->lock);
+	return 1;
+}
 
+/*
+ * Auxiliary function:
+ * copies the value of the key out, under the node lock
+ */
+int list_get(Hashtable table, int bucket, int key, void* out,
+		uint64_t deadline) {
+	Node* link;
+	lock_t* held;
+	Node dead;
+	Node curr = list_find(table, bucket, key, &link, &held, &dead, deadline);
+	if (!held) {
+		node_reclaim(table, bucket, dead);
+		return HASH_BUSY;
+	}
+	curr = list_promote(table, bucket, held, curr);
+	if (!curr) {
+		node_reclaim(table, bucket, dead);
+		return 0;
+	}
+	node_touch(table, curr);
+	if (table->value_size)
+		memcpy(out, curr->value, table->value_size);
+	else
+		*(void**) out = curr->value;
+	lock_release(&curr->lock);
+	return 1;
 }
 
 /*
@@ -149,130 +676,1487 @@ int list_update(Node head, int key, void* val) {
  * removes element by the key
  * in one bucket
  */
-int list_remove(Node head, int key) {
-	Node curr, prev;
-	curr = head->next;
-	prev = head;
-	pthread_mutex_lock(&prev->mutex);
-	if (!head)
+int list_remove(Hashtable table, int bucket, int key, uint64_t deadline) {
+	Node* link;
+	lock_t* held;
+	Node dead;
+	Node curr = list_find(table, bucket, key, &link, &held, &dead, deadline);
+	if (!held) {
+		node_reclaim(table, bucket, dead);
+		return HASH_BUSY;
+	}
+	if (!curr) {
+		lock_release(held);
+		node_reclaim(table, bucket, dead);
 		return 0;
+	}
+	//the compactor unlinks and frees it later
+	change_note(table, bucket, REMOVE, curr);
+	if (table->bloom)
+		bloom_add(table, bucket, key, -1);
+	if (table->flags & HASH_TOMBSTONES) {
+		curr->tombstone = 1;
+		lock_release(held);
+		lock_release(&curr->lock);
+		return 1;
+	}
+	*link = curr->next;
+	lock_release(held);
+	lock_release(&curr->lock);
+	node_free(table, curr);
+	return 1;
+}
 
-	while (curr) {
-		pthread_mutex_lock(&curr->mutex);
-		if (curr->key == key) {
-			prev->next = curr->next;
-			pthread_mutex_unlock(&prev->mutex);
-			pthread_mutex_unlock(&curr->mutex);
-			pthread_mutex_destroy(&curr->mutex);
-			free(curr);
-			return 1;
-		}
-		pthread_mutex_unlock(&prev->mutex);
-		prev = curr;
-		curr = curr->next;
+int list_contains(Hashtable table, int bucket, int key, uint64_t deadline) {
+	Node* link;
+	lock_t* held;
+	Node dead;
+	Node curr = list_find(table, bucket, key, &link, &held, &dead, deadline);
+	if (!held) {
+		node_reclaim(table, bucket, dead);
+		return HASH_BUSY;
 	}
-	pthread_mutex_unlock(&prev->mutex);
-	return 0;
+	curr = list_promote(table, bucket, held, curr);
+	if (!curr) {
+		node_reclaim(table, bucket, dead);
+		return 0;
+	}
+	node_touch(table, curr);
+	lock_release(&curr->lock);
+	return 1;
 }
 
-bool list_contains(Node head, int key) {
-	Node curr, prev;
-	curr = head;
-	prev = NULL;
-	if (!head)
-		return false;
+/*
+ * Auxiliary function:
+ * applies compute_func on the value of the key, under the node lock
+ */
+int list_compute(Hashtable table, int bucket, int key,
+		void* (*compute_func)(void*), void** result, uint64_t deadline) {
+	Node* link;
+	lock_t* held;
+	Node dead;
+	Node curr = list_find(table, bucket, key, &link, &held, &dead, deadline);
+	if (!held) {
+		node_reclaim(table, bucket, dead);
+		return HASH_BUSY;
+	}
+	curr = list_promote(table, bucket, held, curr);
+	if (!curr) {
+		node_reclaim(table, bucket, dead);
+		return 0;
+	}
+	node_touch(table, curr);
+	*result = compute_func(curr->value);
+	change_note(table, bucket, COMPUTE, curr);
+	lock_release(&curr->lock);
+	return 1;
+}
+
+/*
+ * Auxiliary function:
+ * one CLOCK step on a bucket: clears the reference bits it passes and
+ * evicts the first node that didn't have it set.
+ * returns true if a node was evicted. With a deadline (see walk_lock) it
+ * stops at a lock that stays held.
+ */
+static bool list_evict(Hashtable table, int bucket, uint64_t deadline) {
+	lock_t* prev_lock = &table->bucket_locks[bucket];
+	Node* prev_link = &table->table[bucket];
 
+	if (!walk_lock(prev_lock, deadline))
+		return false;
+	Node curr = *prev_link;
 	while (curr) {
-		pthread_mutex_lock(&curr->mutex);
-		if (curr->key == key) {
-			if (prev) {
-				pthread_mutex_unlock(&prev->mutex);
-			}
-			pthread_mutex_unlock(&curr->mutex);
+		if (!walk_lock(&curr->lock, deadline))
+			break;
+		if (!curr->tombstone
+				&& !__atomic_exchange_n(&curr->referenced, 0, __ATOMIC_RELAXED)) {
+			*prev_link = curr->next;
+			change_note(table, bucket, REMOVE, curr);
+			lock_release(prev_lock);
+			lock_release(&curr->lock);
+			bucket_size_add(table, bucket, -1);
+			if (table->bloom)
+				bloom_add(table, bucket, curr->key, -1);
+			if (table->evict_func)
+				table->evict_func(curr->key, curr->value);
+			node_free(table, curr);
 			return true;
 		}
-		if (prev) {
-			pthread_mutex_unlock(&prev->mutex);
-		}
-		prev = curr;
+		lock_release(prev_lock);
+		prev_lock = &curr->lock;
+		prev_link = &curr->next;
 		curr = curr->next;
 	}
-	pthread_mutex_unlock(&prev->mutex);
+	lock_release(prev_lock);
 	return false;
 }
 
-//-----------------------------------------------------//
-//Implementations of requested functions
-//Done
-hashtable_t* hash_alloc(int buckets, int (*hash)(int, int)) {
+/*
+ * Auxiliary function:
+ * evicts until the table is back under its capacity.
+ * every evicting thread advances the shared clock hand to claim its own
+ * buckets, there is no global lock. With a deadline the buckets it can't
+ * lock in time are passed over.
+ */
+static void clock_evict(Hashtable table, uint64_t deadline) {
+	//two full turns of the hand clear every bit and find a victim
+	int steps = 2 * table->nr_buckets + 1;
+	while (__atomic_load_n(&table->nr_entries, __ATOMIC_RELAXED)
+			> table->capacity && steps-- > 0) {
+		int bucket = __atomic_fetch_add(&table->clock_hand, 1, __ATOMIC_RELAXED)
+				% (unsigned int) table->nr_buckets;
+		if (table->bucket_rw
+				&& !walk_rdlock(&table->bucket_rw[bucket], deadline))
+			continue;
+		if (list_evict(table, bucket, deadline))
+			steps = 2 * table->nr_buckets + 1;
+		if (table->bucket_rw)
+			pthread_rwlock_unlock(&table->bucket_rw[bucket]);
+	}
+}
 
-	hashtable_t* hashtable;
+/*
+ * Auxiliary function:
+ * unlinks every dead node of the bucket, returns how many
+ */
+static int list_sweep(Hashtable table, int bucket, uint64_t now) {
+	lock_t* prev_lock = &table->bucket_locks[bucket];
+	Node* prev_link = &table->table[bucket];
+	Node dead = NULL;
+	int count = 0;
+
+	lock_acquire(prev_lock);
+	Node curr = *prev_link;
+	while (curr) {
+		lock_acquire(&curr->lock);
+		if (node_dead(curr, now)) {
+			*prev_link = curr->next;
+			if (!curr->tombstone)
+				change_note(table, bucket, REMOVE, curr);
+			lock_release(&curr->lock);
+			curr->next = dead;
+			dead = curr;
+			curr = *prev_link;
+			count++;
+			continue;
+		}
+		lock_release(prev_lock);
+		prev_lock = &curr->lock;
+		prev_link = &curr->next;
+		curr = curr->next;
+	}
+	lock_release(prev_lock);
+	node_reclaim(table, bucket, dead);
+	return count;
+}
 
-	if (buckets < 1 || hash == NULL)
-		return NULL;
+/*
+ * Auxiliary function:
+ * the sweeper thread of HASH_TTL and HASH_TOMBSTONES tables, it compacts
+ * a step of buckets every sweep_ms until hash_stop, so that every bucket
+ * is compacted within SWEEP_PASSES steps whatever the size of the table.
+ * It runs at normal priority: it holds bucket and node locks the ops wait
+ * for, an idle thread could be kept from letting them go.
+ */
+static void* sweeper_routine(void* arg) {
+	Hashtable table = arg;
+	int step = table->nr_buckets / SWEEP_PASSES + 1;
+	if (step < SWEEP_STEP)
+		step = SWEEP_STEP;
+	if (step > table->nr_buckets)
+		step = table->nr_buckets;
+
+	int bucket = 0;
+	pthread_mutex_lock(&table->sweep_lock);
+	while (!table->stopped) {
+		pthread_mutex_unlock(&table->sweep_lock);
+		bool reseed = table->flags & HASH_AUTO_RESEED;
+		uint64_t now = clock_ns();
+		for (int i = 0; i < step; ++i) {
+			//a reseed waits for SWEEP_STEP buckets at most
+			if (reseed && i % SWEEP_STEP == 0)
+				pthread_rwlock_rdlock(&table->resize_lock);
+			if (table->bucket_rw)
+				pthread_rwlock_rdlock(&table->bucket_rw[bucket]);
+			list_sweep(table, bucket, now);
+			if (table->bucket_rw)
+				pthread_rwlock_unlock(&table->bucket_rw[bucket]);
+			bucket = (bucket + 1) % table->nr_buckets;
+			if (reseed && (i % SWEEP_STEP == SWEEP_STEP - 1 || i == step - 1))
+				pthread_rwlock_unlock(&table->resize_lock);
+		}
+
+		struct timespec until;
+		clock_gettime(CLOCK_MONOTONIC, &until);
+		until.tv_sec += table->sweep_ms / 1000;
+		until.tv_nsec += (table->sweep_ms % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_mutex_lock(&table->sweep_lock);
+		if (!table->stopped)
+			pthread_cond_timedwait(&table->sweep_condition, &table->sweep_lock,
+					&until);
+	}
+	pthread_mutex_unlock(&table->sweep_lock);
+	return NULL;
+}
+
+/*
+ * Auxiliary function:
+ * built-in seeded hash, splitmix64 finalizer over the seeded key
+ */
+static inline uint32_t builtin_hash(uint64_t seed, int key) {
+	uint64_t x = (uint32_t) key ^ seed;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (uint32_t) ((x ^ (x >> 31)) >> 32);
+}
+
+/*
+ * Auxiliary function:
+ * maps a 32 bit hash to [0, buckets) without a division
+ */
+static inline int builtin_range(uint32_t hash, int buckets) {
+	return (int) (((uint64_t) hash * (uint32_t) buckets) >> 32);
+}
+
+static uint64_t random_seed() {
+	uint64_t seed;
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		seed = ((uint64_t) now.tv_sec << 32) ^ now.tv_nsec ^ (uintptr_t) &now;
+	}
+	return seed;
+}
+
+/*
+ * Auxiliary function:
+ * fibonacci hashing for power of two tables - one multiply and a shift
+ */
+static inline int fibonacci_bucket(uint64_t seed, int key, int shift) {
+	uint64_t x = (uint32_t) key ^ (uint32_t) seed;
+	return (int) ((x * 0x9e3779b97f4a7c15ULL) >> shift);
+}
+
+/*
+ * Auxiliary function:
+ * maps key to its bucket, -1 if the hash function is out of range
+ */
+static inline int hash_bucket(Hashtable table, int key) {
+	if (table->shift)
+		return fibonacci_bucket(table->seed, key, table->shift);
+	if (!table->hash_func)
+		return builtin_range(builtin_hash(table->seed, key), table->nr_buckets);
+	int hashed_key = table->hash_func(table->nr_buckets, key);
+	if (hashed_key < 0 || hashed_key >= table->nr_buckets) {
+		return -1;
+	}
+	return hashed_key;
+}
+
+/*
+ * Auxiliary function:
+ * CLOCK_MONOTONIC deadline in ns of an INSERT or UPDATE with a ttl, 0 for
+ * none. A negative ttl is an error the caller checks for.
+ */
+static uint64_t op_expires(Hashtable table, Op op) {
+	if (!(table->flags & HASH_TTL) || op->ttl_ms <= 0
+			|| (op->op != INSERT && op->op != UPDATE))
+		return 0;
+	return ttl_now() + (uint64_t) op->ttl_ms * 1000000ULL;
+}
+
+/*
+ * Auxiliary function:
+ * links the new node of an INSERT, frees it if the key is there already
+ */
+static int bucket_insert(Hashtable table, int bucket, Node element,
+		uint64_t deadline) {
+	int result = list_add(table, bucket, element, deadline);
+	if (result == 1)
+		bucket_size_add(table, bucket, 1);
+	else if (element)
+		node_free(table, element);
+	return result;
+}
+
+/*
+ * Auxiliary function:
+ * executes one operation on its bucket and stores the outcome in op->result.
+ * COMPUTE stores the compute result in op->val. A walk that gives up on
+ * the deadline (see walk_lock) leaves the bucket as it was, result HASH_BUSY.
+ * With HASH_BLOOM the ops on a key the filter rules out fail right away.
+ */
+static void bucket_execute(Hashtable table, int bucket, Op op,
+		uint64_t deadline) {
+	if ((table->flags & HASH_TTL) && op->ttl_ms < 0
+			&& (op->op == INSERT || op->op == UPDATE)) {
+		op->result = -1;
+		return;
+	}
+	uint64_t expires = op_expires(table, op);
+	if (table->bloom && op->op >= REMOVE && op->op <= GET
+			&& !bloom_may_contain(table, bucket, op->key)) {
+		op->result = 0;
+		return;
+	}
+
+	switch (op->op) {
+	case INSERT: {
+		Node new_element = node_alloc(table, bucket, op->key, op->val);
+		if (new_element)
+			new_element->expires = expires;
+		op->result = bucket_insert(table, bucket, new_element, deadline);
+		break;
+	}
+	case REMOVE:
+		op->result = list_remove(table, bucket, op->key, deadline);
+		if (op->result == 1)
+			bucket_size_add(table, bucket, -1);
+		break;
+	case CONTAINS:
+		op->result = list_contains(table, bucket, op->key, deadline);
+		break;
+	case UPDATE:
+		op->result = list_update(table, bucket, op->key, op->val, expires,
+				deadline);
+		break;
+	case COMPUTE:
+		op->result = list_compute(table, bucket, op->key, op->compute_func,
+				&op->val, deadline);
+		break;
+	case GET:
+		op->result = list_get(table, bucket, op->key, op->val, deadline);
+		break;
+	default:
+		op->result = -1;
+	}
+}
+
+/*
+ * Auxiliary function:
+ * runs every op published on the bucket, in publication order.
+ * called with the combiner lock of the bucket held.
+ */
+static void fc_combine(Hashtable table, int bucket) {
+	FcRecord pending = __atomic_exchange_n(&table->fc_pending[bucket], NULL,
+			__ATOMIC_ACQUIRE);
+
+	//the publication list is a stack, reverse it to keep arrival order
+	FcRecord ordered = NULL;
+	while (pending) {
+		FcRecord next = pending->next;
+		pending->next = ordered;
+		ordered = pending;
+		pending = next;
+	}
+
+	while (ordered) {
+		//the record may disappear as soon as done is set
+		FcRecord next = ordered->next;
+		bucket_execute(table, bucket, ordered->op, 0);
+		__atomic_store_n(&ordered->done, 1, __ATOMIC_RELEASE);
+		ordered = next;
+	}
+}
+
+/*
+ * Auxiliary function:
+ * flat combining execution of an op.
+ * the op is published on the bucket and whoever holds the combiner lock
+ * executes all the published ops in one pass.
+ */
+static void fc_execute(Hashtable table, int bucket, Op op) {
+	lock_t* combiner = &table->fc_locks[bucket];
+
+	//nobody is waiting - run directly, no need to publish
+	if (__atomic_load_n(&table->fc_pending[bucket], __ATOMIC_RELAXED) == NULL
+			&& lock_try(combiner)) {
+		bucket_execute(table, bucket, op, 0);
+		fc_combine(table, bucket);
+		lock_release(combiner);
+		return;
+	}
+
+	struct fc_record_t record = { op, 0, NULL };
+	record.next = __atomic_load_n(&table->fc_pending[bucket], __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&table->fc_pending[bucket],
+			&record.next, &record, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+
+	while (!__atomic_load_n(&record.done, __ATOMIC_ACQUIRE)) {
+		if (lock_try(combiner)) {
+			fc_combine(table, bucket);
+			lock_release(combiner);
+		} else {
+			sched_yield();
+		}
+	}
+}
+
+/*
+ * Auxiliary function:
+ * redistributes every node with a new seed.
+ * called with the resize lock held exclusively, so no op is in the table.
+ */
+static void hash_rehash(Hashtable table) {
+	Node* tails = malloc(sizeof(Node) * table->nr_buckets);
+	if (!tails)
+		return;
+
+	//unlink all the nodes into one list
+	Node all = NULL;
+	for (int i = 0; i < table->nr_buckets; ++i) {
+		Node curr = table->table[i];
+		while (curr) {
+			Node next = curr->next;
+			curr->next = all;
+			all = curr;
+			curr = next;
+		}
+		table->table[i] = NULL;
+		tails[i] = NULL;
+		table->buckets_sizes[i] = 0;
+		if (table->bloom)
+			table->bloom[i] = 0;
+	}
+
+	table->seed = random_seed();
+	while (all) {
+		Node next = all->next;
+		//tombstones already left the table, nobody walks to them now
+		if (all->tombstone) {
+			node_free(table, all);
+			all = next;
+			continue;
+		}
+		int bucket = hash_bucket(table, all->key);
+		all->next = NULL;
+		if (tails[bucket])
+			tails[bucket]->next = all;
+		else
+			table->table[bucket] = all;
+		tails[bucket] = all;
+		table->buckets_sizes[bucket]++;
+		//the new seed picks other counters, the stuck ones start over
+		if (table->bloom)
+			bloom_add(table, bucket, all->key, 1);
+		all = next;
+	}
+	free(tails);
+	table->nr_reseeds++;
+	//every bucket of the last checkpoint means other keys now
+	if (table->dirty)
+		table->checkpoint_full = 1;
+}
+
+/*
+ * Auxiliary function:
+ * checks after an insert if the bucket grew much longer than the average
+ */
+static void reseed_check(Hashtable table, int bucket) {
+	int size = __atomic_load_n(&table->buckets_sizes[bucket], __ATOMIC_RELAXED);
+	int average = __atomic_load_n(&table->nr_entries, __ATOMIC_RELAXED)
+			/ table->nr_buckets;
+	int inserts = __atomic_add_fetch(&table->inserts_since_reseed, 1,
+			__ATOMIC_RELAXED);
+	//the first skew reseeds right away, another one only after a fair
+	//amount of new keys, so a flood can't keep the table rehashing
+	if (size > table->max_chain && size > 4 * average
+			&& (!table->nr_reseeds || inserts >= 4 * table->max_chain))
+		__atomic_store_n(&table->reseed_pending, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Auxiliary function:
+ * transparently rehashes the table when a skewed bucket was detected
+ */
+static void reseed_if_pending(Hashtable table) {
+	if (!__atomic_load_n(&table->reseed_pending, __ATOMIC_RELAXED))
+		return;
+	pthread_rwlock_wrlock(&table->resize_lock);
+	//another thread may have already done it
+	if (table->reseed_pending) {
+		hash_rehash(table);
+		table->reseed_pending = 0;
+		table->inserts_since_reseed = 0;
+	}
+	pthread_rwlock_unlock(&table->resize_lock);
+}
+
+#ifdef HASH_HAVE_AVX2
+/*
+ * Auxiliary function:
+ * low 64 bits of a 64x64 multiply in every lane, AVX2 only has 32x32
+ */
+__attribute__((target("avx2")))
+static inline __m256i mullo_epi64(__m256i a, __m256i b) {
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i cross = _mm256_add_epi64(
+			_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+			_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+/*
+ * Auxiliary function:
+ * the built-in hashes of hash_bucket, four keys per iteration.
+ * returns how many keys were done, the tail is left to the scalar code.
+ */
+__attribute__((target("avx2")))
+static int builtin_buckets_avx2(Hashtable table, const int* keys, int* out,
+		int n) {
+	const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	const __m256i buckets = _mm256_set1_epi64x((uint32_t) table->nr_buckets);
+	const __m256i golden = _mm256_set1_epi64x(0x9e3779b97f4a7c15ULL);
+	const __m256i c1 = _mm256_set1_epi64x(0xbf58476d1ce4e5b9ULL);
+	const __m256i c2 = _mm256_set1_epi64x(0x94d049bb133111ebULL);
+	const __m128i shift = _mm_cvtsi32_si128(table->shift);
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_cvtepu32_epi64(
+				_mm_loadu_si128((const __m128i *) (keys + i)));
+		if (table->shift) {
+			x = _mm256_xor_si256(x,
+					_mm256_set1_epi64x((uint32_t) table->seed));
+			x = _mm256_srl_epi64(mullo_epi64(x, golden), shift);
+		} else {
+			x = _mm256_xor_si256(x, _mm256_set1_epi64x(table->seed));
+			x = mullo_epi64(_mm256_xor_si256(x, _mm256_srli_epi64(x, 30)), c1);
+			x = mullo_epi64(_mm256_xor_si256(x, _mm256_srli_epi64(x, 27)), c2);
+			x = _mm256_srli_epi64(_mm256_xor_si256(x, _mm256_srli_epi64(x, 31)),
+					32);
+			x = _mm256_srli_epi64(_mm256_mul_epu32(x, buckets), 32);
+		}
+		x = _mm256_permutevar8x32_epi32(x, pack);
+		_mm_storeu_si128((__m128i *) (out + i), _mm256_castsi256_si128(x));
+	}
+	return i;
+}
+#endif
+
+/*
+ * Auxiliary function:
+ * hash_bucket for many keys at once, -1 for keys the hash puts out of range.
+ * returns the reseed generation the buckets belong to.
+ */
+static int hash_route(Hashtable table, const int* keys, int* out, int n) {
+	bool reseed = table->flags & HASH_AUTO_RESEED;
+	if (reseed)
+		pthread_rwlock_rdlock(&table->resize_lock);
+
+	int i = 0;
+	if (table->cuckoo) {
+		for (; i < n; ++i) {
+			out[i] = cuckoo_bucket(table->cuckoo, keys[i]);
+		}
+	} else if (table->shm) {
+		for (; i < n; ++i) {
+			out[i] = shmtable_bucket(table->shm, keys[i]);
+		}
+	} else if (table->hash_func && table->hash_many) {
+		table->hash_many(table->nr_buckets, keys, out, n);
+		for (; i < n; ++i) {
+			if (out[i] < 0 || out[i] >= table->nr_buckets)
+				out[i] = -1;
+		}
+	}
+#ifdef HASH_HAVE_AVX2
+	if (i == 0 && !table->hash_func && __builtin_cpu_supports("avx2"))
+		i = builtin_buckets_avx2(table, keys, out, n);
+#endif
+	for (; i < n; ++i) {
+		out[i] = hash_bucket(table, keys[i]);
+	}
+
+	int generation = table->nr_reseeds;
+	if (reseed)
+		pthread_rwlock_unlock(&table->resize_lock);
+	return generation;
+}
+
+/*
+ * Auxiliary function:
+ * executes an op, returns op->result.
+ * bucket is where hash_route sent the key in the given reseed generation,
+ * or -1 to route the key here. With a deadline (see walk_lock) the op
+ * gives up with HASH_BUSY on a table lock or a walk lock that stays held;
+ * the cuckoo and shared memory engines have no such walk (-1).
+ */
+static int hash_execute_routed(Hashtable table, Op op, int bucket,
+		int generation, uint64_t deadline) {
+	if ((table->cuckoo || table->shm) && deadline) {
+		op->result = -1;
+		return -1;
+	}
+	if (table->cuckoo)
+		return cuckoo_execute(table->cuckoo, op);
+	if (table->shm)
+		return shmtable_execute(table->shm, op);
+
+	bool reseed = table->flags & HASH_AUTO_RESEED;
+	if (reseed && !walk_rdlock(&table->resize_lock, deadline)) {
+		op->result = HASH_BUSY;
+		return HASH_BUSY;
+	}
+
+	//the route is stale if the table was reseeded since
+	if (bucket < 0 || generation != table->nr_reseeds)
+		bucket = hash_bucket(table, op->key);
+	if (bucket < 0) {
+		op->result = -1;
+		if (reseed)
+			pthread_rwlock_unlock(&table->resize_lock);
+		return -1;
+	}
+
+	if (table->bucket_rw && !walk_rdlock(&table->bucket_rw[bucket], deadline)) {
+		op->result = HASH_BUSY;
+	} else {
+		//the combiner may be busy for long, an op with a deadline walks itself
+		if ((table->flags & HASH_FLAT_COMBINING) && !deadline)
+			fc_execute(table, bucket, op);
+		else
+			bucket_execute(table, bucket, op, deadline);
+		if (table->bucket_rw)
+			pthread_rwlock_unlock(&table->bucket_rw[bucket]);
+	}
+	if (table->capacity && op->op == INSERT && op->result == 1)
+		clock_evict(table, deadline);
+
+	if (reseed) {
+		if (op->op == INSERT && op->result == 1)
+			reseed_check(table, bucket);
+		pthread_rwlock_unlock(&table->resize_lock);
+		//a rehash waits for every op, it is left to the next blocking one
+		if (!deadline)
+			reseed_if_pending(table);
+	}
+	return op->result;
+}
+
+/*
+ * Auxiliary function:
+ * routes an op to its bucket and executes it, returns op->result
+ */
+static int hash_execute(Hashtable table, Op op) {
+	return hash_execute_routed(table, op, -1, 0, 0);
+}
+
+static int int_compare(const void* a, const void* b) {
+	int x = *(const int*) a, y = *(const int*) b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Auxiliary function:
+ * checks a transaction against the table without changing it.
+ * called with all the buckets of the transaction locked exclusively.
+ * returns the index of the first op that would fail, -1 if all succeed,
+ * VALIDATE_NO_MEMORY if it couldn't allocate its bookkeeping.
+ */
+static int transaction_validate(Hashtable table, int num_ops, op_t* ops,
+		const int* buckets) {
+	//what the earlier ops of the transaction did to each key
+	int* keys = malloc(sizeof(int) * num_ops);
+	bool* present = malloc(sizeof(bool) * num_ops);
+	int nr_keys = 0;
+	int failed = -1;
+	if (!keys || !present) {
+		free(keys);
+		free(present);
+		return VALIDATE_NO_MEMORY;
+	}
+
+	for (int i = 0; i < num_ops && failed < 0; ++i) {
+		int k = 0;
+		while (k < nr_keys && keys[k] != ops[i].key)
+			k++;
+		if (k == nr_keys) {
+			keys[k] = ops[i].key;
+			present[k] = list_contains(table, buckets[i], ops[i].key, 0);
+			nr_keys++;
+		}
+
+		//the same check bucket_execute makes
+		if ((table->flags & HASH_TTL) && ops[i].ttl_ms < 0
+				&& (ops[i].op == INSERT || ops[i].op == UPDATE)) {
+			failed = i;
+			break;
+		}
+
+		switch (ops[i].op) {
+		case INSERT:
+			if (present[k])
+				failed = i;
+			present[k] = true;
+			break;
+		case REMOVE:
+			if (!present[k])
+				failed = i;
+			present[k] = false;
+			break;
+		case UPDATE:
+		case COMPUTE:
+			if (!present[k])
+				failed = i;
+			break;
+		case CONTAINS:
+		case GET:
+			break;
+		default:
+			failed = i;
+		}
+	}
+	free(keys);
+	free(present);
+	return failed;
+}
+
+/*
+ * Auxiliary function:
+ * the nodes of the INSERTs of a transaction, allocated before any op is
+ * applied so that running out of memory leaves the table as it was.
+ * NULL if one of them couldn't be allocated.
+ */
+static Node* transaction_nodes(Hashtable table, int num_ops, op_t* ops,
+		const int* buckets) {
+	Node* nodes = calloc(num_ops, sizeof(Node));
+	if (!nodes)
+		return NULL;
+	for (int i = 0; i < num_ops; ++i) {
+		if (ops[i].op != INSERT)
+			continue;
+		nodes[i] = node_alloc(table, buckets[i], ops[i].key, ops[i].val);
+		if (!nodes[i]) {
+			for (int j = 0; j < i; ++j) {
+				if (nodes[j])
+					node_free(table, nodes[j]);
+			}
+			free(nodes);
+			return NULL;
+		}
+		nodes[i]->expires = op_expires(table, &ops[i]);
+	}
+	return nodes;
+}
+
+/*
+ * Iterator state: the entries of the current bucket, copied out
+ */
+struct hash_iter_t {
+	Hashtable table;
+	int bucket; //next bucket to copy
+	int pos, count, capacity;
+	int* keys;
+	unsigned char* values; //value_size bytes, or a void*, per entry
+};
+
+static int iter_width(Hashtable table) {
+	return table->value_size ? table->value_size : (int) sizeof(void*);
+}
+
+/*
+ * Auxiliary function:
+ * copies the live entries of a bucket into the iterator.
+ * returns -1 if the buffers can't grow.
+ */
+static int iter_load(hash_iter_t* iter, int bucket) {
+	Hashtable table = iter->table;
+	int width = iter_width(table);
+	lock_t* prev_lock = &table->bucket_locks[bucket];
+	uint64_t now = (table->flags & HASH_TTL) ? clock_ns() : 0;
+	int res = 0;
+
+	iter->pos = iter->count = 0;
+	lock_acquire(prev_lock);
+	Node curr = table->table[bucket];
+	while (curr) {
+		lock_acquire(&curr->lock);
+		lock_release(prev_lock);
+		prev_lock = &curr->lock;
+		if (!node_dead(curr, now)) {
+			if (iter->count == iter->capacity) {
+				int capacity = iter->capacity ? 2 * iter->capacity : 16;
+				int* keys = realloc(iter->keys, sizeof(int) * capacity);
+				if (keys)
+					iter->keys = keys;
+				unsigned char* values = realloc(iter->values,
+						(size_t) width * capacity);
+				if (values)
+					iter->values = values;
+				if (!keys || !values) {
+					res = -1;
+					break;
+				}
+				iter->capacity = capacity;
+			}
+			iter->keys[iter->count] = curr->key;
+			if (table->value_size)
+				memcpy(iter->values + (size_t) width * iter->count, curr->value,
+						width);
+			else
+				memcpy(iter->values + (size_t) width * iter->count,
+						&curr->value, width);
+			iter->count++;
+		}
+		curr = curr->next;
+	}
+	lock_release(prev_lock);
+	return res;
+}
+
+/*
+ * Checkpoint stream: a header, then a record per bucket written - its
+ * index and entry count, followed by the entries, each a key and the value
+ * as hash_get copies it out - and an end record with bucket -1.
+ * Checkpoints appended one after the other make a base image and its deltas.
+ */
+typedef struct checkpoint_header_t {
+	uint32_t magic;
+	int32_t full; //base image, the buckets it doesn't have are empty
+	int32_t nr_buckets, value_size;
+	uint64_t generation;
+} checkpoint_header_t;
+
+typedef struct checkpoint_bucket_t {
+	int32_t bucket, count;
+} checkpoint_bucket_t;
+
+typedef struct ckpt_writer_t {
+	int fd, failed;
+	size_t used;
+	unsigned char buffer[CHECKPOINT_BUFFER];
+}* CkptWriter;
+
+/*
+ * Merged checkpoints: per bucket its entry count followed by the entries,
+ * NULL for an empty bucket
+ */
+typedef struct ckpt_image_t {
+	checkpoint_header_t header; //of the last checkpoint merged
+	unsigned char** buckets;
+} ckpt_image_t;
+
+static int write_full(int fd, const void* data, size_t size) {
+	const unsigned char* next = data;
+	while (size) {
+		ssize_t written = write(fd, next, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		next += written;
+		size -= written;
+	}
+	return 0;
+}
+
+/*
+ * Auxiliary function:
+ * returns how many bytes were read, less than size only at the end of fd,
+ * or -1
+ */
+static ssize_t read_full(int fd, void* data, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t got = read(fd, (unsigned char*) data + done, size - done);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			return -1;
+		if (got == 0)
+			break;
+		done += got;
+	}
+	return done;
+}
+
+static void ckpt_put(CkptWriter writer, const void* data, size_t size) {
+	if (writer->failed)
+		return;
+	if (writer->used + size > CHECKPOINT_BUFFER) {
+		writer->failed = write_full(writer->fd, writer->buffer, writer->used);
+		writer->used = 0;
+		if (size > CHECKPOINT_BUFFER && !writer->failed) {
+			writer->failed = write_full(writer->fd, data, size);
+			return;
+		}
+	}
+	memcpy(writer->buffer + writer->used, data, size);
+	writer->used += size;
+}
+
+static void ckpt_flush(CkptWriter writer) {
+	if (!writer->failed && writer->used)
+		writer->failed = write_full(writer->fd, writer->buffer, writer->used);
+	writer->used = 0;
+}
+
+/*
+ * Auxiliary function:
+ * writes the entries copied into iter as the record of bucket
+ */
+static void ckpt_put_bucket(CkptWriter writer, hash_iter_t* iter, int bucket) {
+	int width = iter_width(iter->table);
+	checkpoint_bucket_t record = { bucket, iter->count };
+	ckpt_put(writer, &record, sizeof(record));
+	for (int i = 0; i < iter->count; ++i) {
+		int32_t key = iter->keys[i];
+		ckpt_put(writer, &key, sizeof(key));
+		ckpt_put(writer, iter->values + (size_t) width * i, width);
+	}
+}
+
+static void image_free(ckpt_image_t* image) {
+	if (!image->buckets)
+		return;
+	for (int i = 0; i < image->header.nr_buckets; ++i) {
+		free(image->buckets[i]);
+	}
+	free(image->buckets);
+	image->buckets = NULL;
+}
+
+/*
+ * Auxiliary function:
+ * merges the checkpoints of fd up to its end: a base image drops all it
+ * had so far, a bucket of a delta replaces the bucket it had.
+ * returns 0, or -1 on a bad or truncated stream
+ */
+static int image_read(int fd, ckpt_image_t* image) {
+	checkpoint_header_t header;
+	ssize_t got;
+	memset(image, 0, sizeof(*image));
+	while ((got = read_full(fd, &header, sizeof(header))) == sizeof(header)) {
+		if (header.magic != CHECKPOINT_MAGIC || header.nr_buckets < 1
+				|| header.value_size < 1)
+			return -1;
+		if (!image->buckets) {
+			//deltas mean nothing without the base they follow
+			if (!header.full)
+				return -1;
+			image->header = header;
+			image->buckets = calloc(header.nr_buckets, sizeof(unsigned char*));
+			if (!image->buckets)
+				return -1;
+		} else if (header.nr_buckets != image->header.nr_buckets
+				|| header.value_size != image->header.value_size) {
+			return -1;
+		}
+		if (header.full) {
+			for (int i = 0; i < header.nr_buckets; ++i) {
+				free(image->buckets[i]);
+				image->buckets[i] = NULL;
+			}
+		}
+		image->header = header;
+
+		size_t entry = sizeof(int32_t) + (size_t) header.value_size;
+		checkpoint_bucket_t record;
+		while (true) {
+			if (read_full(fd, &record, sizeof(record)) != sizeof(record))
+				return -1;
+			if (record.bucket == -1)
+				break;
+			if (record.bucket < 0 || record.bucket >= header.nr_buckets
+					|| record.count < 0)
+				return -1;
+			unsigned char* entries = NULL;
+			if (record.count) {
+				size_t size = entry * record.count;
+				if ((entries = malloc(sizeof(int32_t) + size)) == NULL)
+					return -1;
+				memcpy(entries, &record.count, sizeof(int32_t));
+				if (read_full(fd, entries + sizeof(int32_t), size)
+						!= (ssize_t) size) {
+					free(entries);
+					return -1;
+				}
+			}
+			free(image->buckets[record.bucket]);
+			image->buckets[record.bucket] = entries;
+		}
+	}
+	return (got == 0 && image->buckets) ? 0 : -1;
+}
+
+/*
+ * Work shared by the threads of a parallel pass over all the buckets:
+ * every thread claims chunks of buckets from cursor until none is left,
+ * so a slow bucket doesn't hold the others back.
+ */
+typedef struct pass_t {
+	Hashtable table;
+	long (*visit)(Hashtable table, int bucket, struct pass_t* pass);
+	void (*fn)(int, void*); //foreach
+	void* (*compute)(void*); //compute_all
+	bool teardown; //the table is being freed, nobody else is in it
+	int cursor;
+	long visited;
+}* Pass;
+
+static void* pass_worker(void* arg) {
+	Pass pass = arg;
+	Hashtable table = pass->table;
+	long visited = 0;
+	int start;
+	while ((start = __atomic_fetch_add(&pass->cursor, PASS_CHUNK,
+			__ATOMIC_RELAXED)) < table->nr_buckets) {
+		int end = start + PASS_CHUNK;
+		if (end > table->nr_buckets)
+			end = table->nr_buckets;
+		for (int bucket = start; bucket < end; ++bucket) {
+			bool locked = table->bucket_rw && !pass->teardown;
+			if (locked)
+				pthread_rwlock_rdlock(&table->bucket_rw[bucket]);
+			visited += pass->visit(table, bucket, pass);
+			if (locked)
+				pthread_rwlock_unlock(&table->bucket_rw[bucket]);
+		}
+	}
+	__atomic_add_fetch(&pass->visited, visited, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/*
+ * Auxiliary function:
+ * runs the pass on nthreads threads, the caller being one of them, at
+ * most one per cpu. returns the sum of what visit returned.
+ */
+static long pass_run(Hashtable table, int nthreads, Pass pass) {
+	int max_threads = (table->nr_buckets + PASS_CHUNK - 1) / PASS_CHUNK;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && max_threads > cpus)
+		max_threads = cpus;
+	if (nthreads > max_threads)
+		nthreads = max_threads;
+	pass->table = table;
+	pass->cursor = 0;
+	pass->visited = 0;
+
+	//without the array the caller runs the pass alone
+	pthread_t* threads = nthreads > 1 ? malloc(sizeof(pthread_t) * nthreads)
+			: NULL;
+	int started = 0;
+	for (int i = 1; threads && i < nthreads; ++i) {
+		if (pthread_create(&threads[started], NULL, pass_worker, pass) == 0)
+			started++;
+	}
+	pass_worker(pass);
+	for (int i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	return pass->visited;
+}
+
+/*
+ * Auxiliary function:
+ * pass_run next to concurrent ops. the table can't reseed meanwhile so
+ * every node is in exactly one bucket.
+ */
+static long buckets_parallel(Hashtable table, int nthreads, Pass pass) {
+	bool reseed = table->flags & HASH_AUTO_RESEED;
+	if (reseed)
+		pthread_rwlock_rdlock(&table->resize_lock);
+	long visited = pass_run(table, nthreads, pass);
+	if (reseed)
+		pthread_rwlock_unlock(&table->resize_lock);
+	return visited;
+}
+
+/*
+ * Auxiliary function:
+ * calls pass->fn, or applies pass->compute, on every live node of the
+ * bucket, under the node lock
+ */
+static long list_foreach(Hashtable table, int bucket, Pass pass) {
+	lock_t* prev_lock = &table->bucket_locks[bucket];
+	long visited = 0;
+	uint64_t now = (table->flags & HASH_TTL) ? clock_ns() : 0;
+
+	lock_acquire(prev_lock);
+	Node curr = table->table[bucket];
+	while (curr) {
+		lock_acquire(&curr->lock);
+		lock_release(prev_lock);
+		if (!node_dead(curr, now)) {
+			if (pass->fn) {
+				pass->fn(curr->key, curr->value);
+			} else {
+				void* value = pass->compute(curr->value);
+				if (!table->value_size)
+					curr->value = value;
+				change_note(table, bucket, COMPUTE, curr);
+			}
+			visited++;
+		}
+		prev_lock = &curr->lock;
+		curr = curr->next;
+	}
+	lock_release(prev_lock);
+	return visited;
+}
+
+static long list_release(Hashtable table, int bucket, Pass pass) {
+	(void) pass; //a visit of a teardown pass, it has nothing to apply
+	long freed = list_destroy(table, table->table[bucket]);
+	table->table[bucket] = NULL;
+	return freed;
+}
+
+static Feed feed_alloc(int size) {
+	Feed feed = calloc(1, sizeof(*feed));
+	if (!feed)
+		return NULL;
+	if (pthread_key_create(&feed->ring_key, feed_ring_release) != 0) {
+		free(feed);
+		return NULL;
+	}
+	feed->size = 1;
+	while (feed->size < (size ? size : HASH_DEFAULT_FEED_SIZE))
+		feed->size <<= 1;
+	feed->seq = feed->expected = 1;
+	pthread_mutex_init(&feed->read_lock, NULL);
+	return feed;
+}
+
+static void feed_free(Feed feed) {
+	if (!feed)
+		return;
+	//threads still alive keep a dangling value under the key, never read
+	pthread_key_delete(feed->ring_key);
+	while (feed->rings) {
+		FeedRing next = feed->rings->next;
+		free(feed->rings);
+		feed->rings = next;
+	}
+	pthread_mutex_destroy(&feed->read_lock);
+	free(feed);
+}
+
+/*
+ * Auxiliary function:
+ * array of an element of size bytes per bucket. with HASH_NUMA the slice
+ * of every node's buckets is in that node's memory, with HASH_HUGE_PAGES
+ * it is in 2MB pages
+ */
+static void* buckets_array(Hashtable table, int buckets, size_t size) {
+	if (table->numa)
+		return numa_spread(table->numa, size);
+	return malloc(size * buckets);
+}
+
+static void buckets_array_free(Hashtable table, void* array, size_t size) {
+	if (table->numa)
+		numa_unspread(table->numa, array, size);
+	else
+		free(array);
+}
+
+/*
+ * Auxiliary function:
+ * frees whatever was allocated for the table, used by alloc failures too.
+ * big tables are torn down by several threads, one per FREE_THREAD_ENTRIES
+ * nodes up to the number of cpus.
+ */
+static void hash_release(Hashtable table) {
+	if (table->table) {
+		long nthreads = table->nr_entries / FREE_THREAD_ENTRIES + 1;
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads > cpus)
+			nthreads = cpus > 1 ? cpus : 1;
+		struct pass_t pass = { .visit = list_release, .teardown = true };
+		pass_run(table, nthreads, &pass);
+	}
+	if (table->bucket_rw) {
+		for (int i = 0; i < table->nr_buckets; ++i) {
+			pthread_rwlock_destroy(&table->bucket_rw[i]);
+		}
+	}
+	free(table->bucket_rw);
+	free(table->dirty);
+	cuckoo_free(table->cuckoo);
+	feed_free(table->feed);
+	shmtable_detach(table->shm);
+	free(table->fc_locks);
+	free(table->fc_pending);
+	buckets_array_free(table, table->sizes_locks, sizeof(lock_t));
+	buckets_array_free(table, table->bucket_locks, sizeof(lock_t));
+	buckets_array_free(table, table->table, sizeof(Node));
+	buckets_array_free(table, table->buckets_sizes, sizeof(int));
+	buckets_array_free(table, table->bloom, sizeof(uint64_t));
+	numa_free(table->numa);
+	free(table->hop_stats);
+	free(table);
+}
+
+/*
+ * Auxiliary function:
+ * allocates the chained buckets and their locks
+ */
+static int chains_alloc(Hashtable table, int buckets) {
+	// Allocate array of nodes, sizes and locks, the ones every op touches
+	table->table = buckets_array(table, buckets, sizeof(Node));
+	table->buckets_sizes = buckets_array(table, buckets, sizeof(int));
+	table->bucket_locks = buckets_array(table, buckets, sizeof(lock_t));
+	table->sizes_locks = buckets_array(table, buckets, sizeof(lock_t));
+	if (!table->table || !table->buckets_sizes
+			|| !table->bucket_locks || !table->sizes_locks) {
+		return -1;
+	}
+
+	// Allocate the filters of the negative lookups
+	if ((table->flags & HASH_BLOOM) && (table->bloom = buckets_array(table,
+			buckets, sizeof(uint64_t))) == NULL) {
+		return -1;
+	}
+
+	// Allocate the publication lists of the flat combining mode
+	if (table->flags & HASH_FLAT_COMBINING) {
+		table->fc_pending = calloc(buckets, sizeof(FcRecord));
+		if (!table->fc_pending) {
+			return -1;
+		}
+		if ((table->fc_locks = malloc(sizeof(lock_t) * buckets))
+				== NULL) {
+			return -1;
+		}
+	}
+
+	// Allocate the bucket locks taken exclusively by transactions
+	if (table->flags & HASH_TRANSACTIONS) {
+		if ((table->bucket_rw = malloc(sizeof(pthread_rwlock_t) * buckets))
+				== NULL) {
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < buckets; i++) {
+		table->table[i] = NULL;
+		table->buckets_sizes[i] = 0;
+		lock_init(&table->bucket_locks[i]);
+		lock_init(&table->sizes_locks[i]);
+		if (table->bloom)
+			table->bloom[i] = 0;
+		if (table->fc_locks)
+			lock_init(&table->fc_locks[i]);
+		if (table->bucket_rw)
+			pthread_rwlock_init(&table->bucket_rw[i], NULL);
+	}
+	return 0;
+}
+
+/*
+ * Auxiliary function:
+ * initializes the thread counting and stopping state of a new table
+ */
+static void hash_init_sync(Hashtable table) {
+	table->nr_threads = 0;
+	table->stopped = 0;
+	pthread_mutex_init(&table->empty_threads_list_lock, NULL);
+	pthread_mutex_init(&table->nr_threads_lock, NULL);
+	pthread_mutex_init(&table->stop_lock, NULL);
+	pthread_cond_init(&table->stop_condition, NULL);
+	pthread_rwlock_init(&table->resize_lock, NULL);
+	pthread_mutex_init(&table->sweep_lock, NULL);
+	//the sweeper times its pauses on CLOCK_MONOTONIC
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&table->sweep_condition, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&table->checkpoint_lock, NULL);
+}
+
+//-----------------------------------------------------//
+//Implementations of requested functions
+//Done
+hashtable_t* hash_alloc(int buckets, int (*hash)(int, int)) {
+	if (hash == NULL)
+		return NULL;
+	return hash_alloc_opts(buckets, hash, NULL);
+}
+
+hashtable_t* hash_alloc_opts(int requested, int (*hash)(int, int),
+		const hash_opts_t* opts) {
+
+	hashtable_t* hashtable;
+	int flags = opts ? opts->flags : 0;
+	int buckets = requested;
+
+	if (requested < 1 || requested > (1 << 30))
+		return NULL;
+	// Only the built-in hash can be reseeded or masked
+	if ((flags & (HASH_AUTO_RESEED | HASH_POW2_BUCKETS)) && hash != NULL)
+		return NULL;
+	// The cuckoo engine has its own locking, hashing and slots
+	if ((flags & HASH_CUCKOO)
+			&& (flags != HASH_CUCKOO || (opts && opts->value_size)))
+		return NULL;
+	if (opts && (opts->value_size < 0 || opts->capacity < 0
+			|| opts->capacity_bytes < 0 || opts->feed_size < 0
+			|| opts->numa_nodes < 0))
+		return NULL;
+	if ((flags & HASH_CUCKOO) && opts
+			&& (opts->capacity || opts->capacity_bytes))
+		return NULL;
+	// A saved void* would dangle once it is restored elsewhere
+	if ((flags & HASH_CHECKPOINT) && opts->value_size < 1)
+		return NULL;
+
+	int shift = 0;
+	if (flags & HASH_POW2_BUCKETS) {
+		int bits = 1;
+		while ((1 << bits) < requested)
+			bits++;
+		buckets = 1 << bits;
+		shift = 64 - bits;
+	}
 
 	// Allocate the table itself.
-	if ((hashtable = malloc(sizeof(*hashtable))) == NULL) {
+	if ((hashtable = calloc(1, sizeof(*hashtable))) == NULL) {
 		return NULL;
 	}
-	// Allocate array of nodes
-	if ((hashtable->table = malloc(sizeof(Node) * buckets)) == NULL) {
-		free(hashtable);
-		return NULL;
+	hashtable->flags = flags;
+	hashtable->value_size = opts ? opts->value_size : 0;
+	if (opts && opts->capacity_bytes) {
+		//the byte budget counts the node and its inline value
+		long entry = sizeof(struct node_t) + hashtable->value_size;
+		long entries = opts->capacity_bytes / entry;
+		hashtable->capacity =
+				entries > INT_MAX ? INT_MAX : (entries > 0 ? entries : 1);
+		if (opts->capacity && opts->capacity < hashtable->capacity)
+			hashtable->capacity = opts->capacity;
+	} else {
+		hashtable->capacity = opts ? opts->capacity : 0;
 	}
-	// Allocate array of the buckets sizes
-	if ((hashtable->buckets_sizes = malloc(sizeof(int) * buckets)) == NULL) {
-		free(hashtable->table);
-		free(hashtable);
+	hashtable->evict_func = opts ? opts->evict : NULL;
+	hashtable->sweep_ms =
+			(opts && opts->sweep_ms > 0) ? opts->sweep_ms : HASH_DEFAULT_SWEEP_MS;
+	hashtable->shift = shift;
+	hashtable->seed = (opts && opts->seed) ? opts->seed : random_seed();
+	hashtable->max_chain =
+			(opts && opts->max_chain > 0) ? opts->max_chain : HASH_DEFAULT_MAX_CHAIN;
+
+	// Place the buckets on the NUMA nodes, and/or on huge pages
+	if ((flags & (HASH_NUMA | HASH_HUGE_PAGES)) && (hashtable->numa = numa_alloc(
+			(flags & HASH_NUMA) ? opts->numa_nodes : 1, buckets,
+			sizeof(struct node_t) + hashtable->value_size,
+			flags & HASH_HUGE_PAGES)) == NULL) {
+		hash_release(hashtable);
 		return NULL;
 	}
-	// Allocate array of mutexs for empty lists
-	if ((hashtable->empty_list_locks = malloc(sizeof(pthread_mutex_t) * buckets))
-			== NULL) {
-		free(hashtable->buckets_sizes);
-		free(hashtable->table);
-		free(hashtable);
+
+	// Allocate the buckets
+	if (flags & HASH_CUCKOO) {
+		if ((hashtable->cuckoo = cuckoo_alloc(buckets, hash, hashtable->seed))
+				== NULL) {
+			hash_release(hashtable);
+			return NULL;
+		}
+	} else if (chains_alloc(hashtable, buckets) < 0) {
+		hash_release(hashtable);
 		return NULL;
 	}
 
-	// Allocate array of mutexs for empty lists
-	if ((hashtable->sizes_locks = malloc(sizeof(pthread_mutex_t) * buckets))
-			== NULL) {
-		hash_free(hashtable);
+	// Allocate the change feed
+	if ((flags & HASH_CHANGE_FEED)
+			&& (hashtable->feed = feed_alloc(opts->feed_size)) == NULL) {
+		hash_release(hashtable);
 		return NULL;
 	}
 
-	for (int i = 0; i < buckets; i++) {
-		hashtable->table[i] = NULL;
-		hashtable->buckets_sizes[i] = 0;
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK_NP);
-		pthread_mutex_init(&hashtable->empty_list_locks[i], &attr);
-		pthread_mutex_init(&hashtable->sizes_locks[i], &attr);
+	// Allocate the hop counters, a cache line per stripe
+	if (flags & HASH_HOP_STATS) {
+		size_t size = sizeof(struct hop_stripe_t) * HOP_STRIPES;
+		if ((hashtable->hop_stats = aligned_alloc(64, size)) == NULL) {
+			hash_release(hashtable);
+			return NULL;
+		}
+		memset(hashtable->hop_stats, 0, size);
+	}
+
+	// Allocate the dirty bits of the checkpoints, the first one is a base image
+	if (flags & HASH_CHECKPOINT) {
+		if ((hashtable->dirty = calloc(buckets, 1)) == NULL) {
+			hash_release(hashtable);
+			return NULL;
+		}
+		hashtable->checkpoint_full = 1;
+	}
 
+	hashtable->hash_func = hash;
+	hashtable->hash_many = opts ? opts->hash_many : NULL;
+	hashtable->nr_buckets = buckets;
+	hash_init_sync(hashtable);
+
+	// Start the sweeper of the expired entries and tombstones
+	if (flags & (HASH_TTL | HASH_TOMBSTONES)) {
+		if (pthread_create(&hashtable->sweeper, NULL, sweeper_routine,
+				hashtable) != 0) {
+			hashtable->stopped = 1;
+			hash_free(hashtable);
+			return NULL;
+		}
+		hashtable->sweeping = true;
 	}
+	return hashtable;
+}
+
+hashtable_t* hash_alloc_fast(int buckets) {
+	hash_opts_t opts = { .flags = HASH_POW2_BUCKETS };
+	return hash_alloc_opts(buckets, NULL, &opts);
+}
 
+hashtable_t* hash_alloc_shm(const char* name, int buckets,
+		int (*hash)(int, int), const hash_opts_t* opts) {
+	// Shared tables store the values inline in a fixed arena, nothing else
+	if (!name || !opts || opts->flags || opts->value_size < 1
+			|| opts->capacity < 1 || opts->capacity_bytes || opts->evict)
+		return NULL;
+
+	hashtable_t* hashtable;
+	if ((hashtable = calloc(1, sizeof(*hashtable))) == NULL) {
+		return NULL;
+	}
+	hashtable->value_size = opts->value_size;
+	hashtable->seed = opts->seed ? opts->seed : random_seed();
+	if ((hashtable->shm = shmtable_attach(name, buckets, hash, hashtable->seed,
+			opts->value_size, opts->capacity)) == NULL) {
+		hash_release(hashtable);
+		return NULL;
+	}
 	hashtable->hash_func = hash;
 	hashtable->nr_buckets = buckets;
-	hashtable->nr_threads = 0;
-	hashtable->stopped = 0;
-
-	pthread_mutexattr_t attr;
-	pthread_mutex_init(&hashtable->empty_threads_list_lock, &attr);
-	pthread_mutex_init(&hashtable->nr_threads_lock, &attr);
-	pthread_mutex_init(&hashtable->stop_lock, &attr);
-	pthread_cond_init(&hashtable->stop_condition, NULL);
+	hash_init_sync(hashtable);
 	return hashtable;
 }
 
+int hash_unlink_shm(const char* name) {
+	if (!name)
+		return -1;
+	return shm_unlink(name) == 0 ? 1 : 0;
+}
+
 int hash_stop(hashtable_t* table) {
 	if (!table)
 		return -1;
 	if (table->stopped == 1) {
 		return -1;
 	}
+	pthread_mutex_lock(&table->sweep_lock);
 	table->stopped = 1;
+	pthread_cond_signal(&table->sweep_condition);
+	pthread_mutex_unlock(&table->sweep_lock);
+	if (table->sweeping)
+		pthread_join(table->sweeper, NULL);
 	while (table->nr_threads > 0) {
 
 	}
@@ -294,20 +2178,15 @@ int hash_free(hashtable_t* ht) {
 		pthread_cond_wait(&ht->stop_condition, &ht->stop_lock);
 	pthread_mutex_unlock(&ht->stop_lock);
 
-	for (int i = 0; i < ht->nr_buckets; ++i) {
-		list_destroy(ht->table[i]);
-		pthread_mutex_destroy(&ht->empty_list_locks[i]);
-		pthread_mutex_destroy(&ht->sizes_locks[i]);
-	}
 	pthread_mutex_destroy(&ht->empty_threads_list_lock);
 	pthread_mutex_destroy(&ht->nr_threads_lock);
 	pthread_mutex_destroy(&ht->stop_lock);
 	pthread_cond_destroy(&ht->stop_condition);
-	free(ht->sizes_locks);
-	free(ht->empty_list_locks);
-	free(ht->table);
-	free(ht->buckets_sizes);
-	free(ht);
+	pthread_rwlock_destroy(&ht->resize_lock);
+	pthread_mutex_destroy(&ht->sweep_lock);
+	pthread_cond_destroy(&ht->sweep_condition);
+	pthread_mutex_destroy(&ht->checkpoint_lock);
+	hash_release(ht);
 	return 1;
 }
 
@@ -318,26 +2197,8 @@ int hash_insert(hashtable_t* table, int key, void* val) {
 	if (table->stopped) {
 		return -1;
 	}
-	Node new_element = node_alloc(key, val);
-	int hashed_key = table->hash_func(table->nr_buckets, key);
-	if (hashed_key < 0 || hashed_key >= table->nr_buckets) {
-		return -1;
-	}
-
-	int retval = list_add(&table->table[hashed_key], new_element,
-			&table->empty_list_locks[hashed_key]);
-
-	if (retval == 0) {
-		free(new_element);
-		return 0;
-	} else if (retval == 1) {
-		pthread_mutex_lock(&table->sizes_locks[hashed_key]);
-		table->buckets_sizes[hashed_key]++;
-		pthread_mutex_unlock(&table->sizes_locks[hashed_key]);
-		return 1;
-	}
-	free(new_element);
-	return -1;
+	op_t op = { .key = key, .val = val, .op = INSERT };
+	return hash_execute(table, &op);
 }
 
 int hash_update(hashtable_t* table, int key, void *val) {
@@ -346,13 +2207,28 @@ int hash_update(hashtable_t* table, int key, void *val) {
 	if (table->stopped) {
 		return -1;
 	}
-	int hashed_key = table->hash_func(table->nr_buckets, key);
-	if (hashed_key < 0 || hashed_key >= table->nr_buckets) {
+	op_t op = { .key = key, .val = val, .op = UPDATE };
+	return hash_execute(table, &op);
+}
+
+int hash_insert_ttl(hashtable_t* table, int key, void* val, long ttl_ms) {
+	if (!table || ttl_ms <= 0)
+		return -1;
+	if (table->stopped || !(table->flags & HASH_TTL)) {
 		return -1;
 	}
+	op_t op = { .key = key, .val = val, .op = INSERT, .ttl_ms = ttl_ms };
+	return hash_execute(table, &op);
+}
 
-	return list_update(table->table[hashed_key], key, val);
-
+int hash_update_ttl(hashtable_t* table, int key, void* val, long ttl_ms) {
+	if (!table || ttl_ms <= 0)
+		return -1;
+	if (table->stopped || !(table->flags & HASH_TTL)) {
+		return -1;
+	}
+	op_t op = { .key = key, .val = val, .op = UPDATE, .ttl_ms = ttl_ms };
+	return hash_execute(table, &op);
 }
 
 int hash_remove(hashtable_t* table, int key) {
@@ -361,91 +2237,184 @@ int hash_remove(hashtable_t* table, int key) {
 	if (table->stopped) {
 		return -1;
 	}
+	op_t op = { .key = key, .op = REMOVE };
+	return hash_execute(table, &op);
+}
 
-	int hashed_key = table->hash_func(table->nr_buckets, key);
-	if (hashed_key < 0 || hashed_key >= table->nr_buckets) {
+int hash_contains(hashtable_t* table, int key) {
+	if (!table)
+		return -1;
+	if (table->stopped) {
 		return -1;
 	}
+	op_t op = { .key = key, .op = CONTAINS };
+	return hash_execute(table, &op);
+}
 
-	Node head = table->table[hashed_key];
-	//The element is the head:
-	if (head) {
-		pthread_mutex_lock(&head->mutex);
-		if (head->key == key) {
-			table->table[hashed_key] = head->next;
-			pthread_mutex_unlock(&head->mutex);
-			pthread_mutex_destroy(&head->mutex);
-			free(head);
-			pthread_mutex_lock(&table->sizes_locks[hashed_key]);
-			table->buckets_sizes[hashed_key]--;
-			pthread_mutex_unlock(&table->sizes_locks[hashed_key]);
-			return 1;
-		}
-		pthread_mutex_unlock(&head->mutex);
-		//----------------------------------------------------
-		int ret = list_remove(head, key);
-		if (ret == 1) {
-			pthread_mutex_lock(&table->sizes_locks[hashed_key]);
-			table->buckets_sizes[hashed_key]--;
-			pthread_mutex_unlock(&table->sizes_locks[hashed_key]);
-			return 1;
-		} else if (ret == -1) {
-			return -1;
-		}
+int list_node_compute(hashtable_t* table, int key, void* (*compute_func)(void*),
+		void** result) {
+	if (!table || !compute_func || !result)
+		return -1;
+
+	op_t op = { .key = key, .op = COMPUTE, .compute_func = compute_func };
+	if (hash_execute(table, &op) == 1)
+		*result = op.val;
+	return op.result;
+}
+
+int hash_get(hashtable_t* table, int key, void* out) {
+	if (!table || !out)
+		return -1;
+	if (table->stopped) {
+		return -1;
 	}
-	return 0;
+	op_t op = { .key = key, .val = out, .op = GET };
+	return hash_execute(table, &op);
 }
 
-int hash_contains(hashtable_t* table, int key) {
+/*
+ * Auxiliary function:
+ * the try and timed variants: executes op giving up on the locks at
+ * deadline (see walk_lock), returns op->result
+ */
+static int hash_execute_until(Hashtable table, Op op, uint64_t deadline) {
 	if (!table)
 		return -1;
 	if (table->stopped) {
 		return -1;
 	}
-	int hashed_key = table->hash_func(table->nr_buckets, key);
-	if (hashed_key < 0 || hashed_key >= table->nr_buckets) {
+	return hash_execute_routed(table, op, -1, 0, deadline);
+}
+
+int hash_try_insert(hashtable_t* table, int key, void* val) {
+	op_t op = { .key = key, .val = val, .op = INSERT };
+	return hash_execute_until(table, &op, DEADLINE_TRY);
+}
+
+int hash_try_update(hashtable_t* table, int key, void* val) {
+	op_t op = { .key = key, .val = val, .op = UPDATE };
+	return hash_execute_until(table, &op, DEADLINE_TRY);
+}
+
+int hash_try_remove(hashtable_t* table, int key) {
+	op_t op = { .key = key, .op = REMOVE };
+	return hash_execute_until(table, &op, DEADLINE_TRY);
+}
+
+int hash_try_contains(hashtable_t* table, int key) {
+	op_t op = { .key = key, .op = CONTAINS };
+	return hash_execute_until(table, &op, DEADLINE_TRY);
+}
+
+int hash_try_get(hashtable_t* table, int key, void* out) {
+	if (!out)
 		return -1;
-	}
+	op_t op = { .key = key, .val = out, .op = GET };
+	return hash_execute_until(table, &op, DEADLINE_TRY);
+}
 
-	if (list_contains(table->table[hashed_key], key))
-		return 1;
-	return 0;
+int hash_try_compute(hashtable_t* table, int key,
+		void* (*compute_func)(void*), void** result) {
+	if (!compute_func || !result)
+		return -1;
+	op_t op = { .key = key, .op = COMPUTE, .compute_func = compute_func };
+	int res = hash_execute_until(table, &op, DEADLINE_TRY);
+	if (res == 1)
+		*result = op.val;
+	return res;
 }
 
-int list_node_compute(hashtable_t* table, int key, void* (*compute_func)(void*),
-		void** result) {
-	if (!table || !compute_func || !result)
+int hash_execute_timed(hashtable_t* table, op_t* op, long timeout_us) {
+	if (!op || timeout_us < 0)
 		return -1;
+	if (op->op == COMPUTE && !op->compute_func)
+		return op->result = -1;
+	uint64_t deadline = timeout_us ?
+			clock_ns() + (uint64_t) timeout_us * 1000ULL : DEADLINE_TRY;
+	op->result = -1;
+	return hash_execute_until(table, op, deadline);
+}
 
-	int hashed_key = table->hash_func(table->nr_buckets, key);
-	if (hashed_key < 0 || hashed_key >= table->nr_buckets) {
+int hash_transaction(hashtable_t* table, int num_ops, op_t* ops) {
+	if (!table || !ops || num_ops < 1)
+		return -1;
+	if (table->stopped || !table->bucket_rw) {
 		return -1;
 	}
 
-	Node curr = table->table[hashed_key];
-	if (!curr)
-		return 0;
+	int* buckets = malloc(sizeof(int) * num_ops);
+	int* order = malloc(sizeof(int) * num_ops);
+	if (!buckets || !order) {
+		free(buckets);
+		free(order);
+		return -1;
+	}
+	bool reseed = table->flags & HASH_AUTO_RESEED;
+	if (reseed)
+		pthread_rwlock_rdlock(&table->resize_lock);
+	for (int i = 0; i < num_ops; ++i) {
+		buckets[i] = order[i] = hash_bucket(table, ops[i].key);
+		if (buckets[i] < 0) {
+			if (reseed)
+				pthread_rwlock_unlock(&table->resize_lock);
+			free(buckets);
+			free(order);
+			return -1;
+		}
+	}
 
-	Node prev = NULL;
-	while (curr) {
-		pthread_mutex_lock(&curr->mutex);
-		if (curr->key == key) {
-			*result = compute_func(curr->value);
-			if (prev) {
-				pthread_mutex_unlock(&prev->mutex);
-			}
-			pthread_mutex_unlock(&curr->mutex);
-			return 1;
+	//lock every bucket once, in ascending order, so transactions can't deadlock
+	qsort(order, num_ops, sizeof(int), int_compare);
+	int nr_locked = 0;
+	for (int i = 0; i < num_ops; ++i) {
+		if (i > 0 && order[i] == order[i - 1])
+			continue;
+		order[nr_locked++] = order[i];
+		pthread_rwlock_wrlock(&table->bucket_rw[order[i]]);
+	}
+
+	//an entry valid for the checks doesn't expire before its op is applied
+	if (table->flags & HASH_TTL)
+		transaction_now = clock_ns();
+	int failed = transaction_validate(table, num_ops, ops, buckets);
+	Node* nodes = NULL;
+	//out of memory: nothing is applied, every op gets -1
+	if (failed == VALIDATE_NO_MEMORY || (failed < 0
+			&& !(nodes = transaction_nodes(table, num_ops, ops, buckets))))
+		failed = num_ops;
+	if (failed < 0) {
+		for (int i = 0; i < num_ops; ++i) {
+			if (nodes[i])
+				ops[i].result = bucket_insert(table, buckets[i], nodes[i], 0);
+			else
+				bucket_execute(table, buckets[i], ops + i, 0);
 		}
-		if (prev) {
-			pthread_mutex_unlock(&prev->mutex);
+		free(nodes);
+	} else {
+		for (int i = 0; i < num_ops; ++i) {
+			ops[i].result = (i == failed) ? 0 : -1;
 		}
-		prev = curr;
-		curr = curr->next;
+	}
+	transaction_now = 0;
 
+	for (int i = nr_locked - 1; i >= 0; --i) {
+		pthread_rwlock_unlock(&table->bucket_rw[order[i]]);
 	}
-	pthread_mutex_unlock(&prev->mutex);
-	return 0;
+	if (table->capacity && failed < 0)
+		clock_evict(table, 0);
+	if (reseed) {
+		for (int i = 0; failed < 0 && i < num_ops; ++i) {
+			if (ops[i].op == INSERT && ops[i].result == 1)
+				reseed_check(table, buckets[i]);
+		}
+		pthread_rwlock_unlock(&table->resize_lock);
+		reseed_if_pending(table);
+	}
+	free(buckets);
+	free(order);
+	if (failed == num_ops)
+		return -1;
+	return failed < 0 ? 1 : 0;
 }
 
 int hash_getbucketsize(hashtable_t* table, int bucket) { //TODO ask if the bucket start from 0?
@@ -454,18 +2423,77 @@ int hash_getbucketsize(hashtable_t* table, int bucket) { //TODO ask if the bucke
 	if (table->stopped) {
 		return -1;
 	}
+	if (table->cuckoo)
+		return cuckoo_bucketsize(table->cuckoo, bucket);
+	if (table->shm)
+		return shmtable_bucketsize(table->shm, bucket);
 	if (bucket < 0 || bucket >= table->nr_buckets)
 		return -1;
-	pthread_mutex_lock(&table->sizes_locks[bucket]);
+	lock_acquire(&table->sizes_locks[bucket]);
 	int res = table->buckets_sizes[bucket];
-	pthread_mutex_unlock(&table->sizes_locks[bucket]);
+	lock_release(&table->sizes_locks[bucket]);
 
 	return res;
 }
 
+int hash_getbucket(hashtable_t* table, int key) {
+	if (!table)
+		return -1;
+	if (table->stopped) {
+		return -1;
+	}
+	if (table->cuckoo)
+		return cuckoo_bucket(table->cuckoo, key);
+	if (table->shm)
+		return shmtable_bucket(table->shm, key);
+	bool reseed = table->flags & HASH_AUTO_RESEED;
+	if (reseed)
+		pthread_rwlock_rdlock(&table->resize_lock);
+	int bucket = hash_bucket(table, key);
+	if (reseed)
+		pthread_rwlock_unlock(&table->resize_lock);
+	return bucket;
+}
+
+int hash_getnode(hashtable_t* table, int bucket) {
+	if (!table || bucket < 0 || bucket >= table->nr_buckets)
+		return -1;
+	return (table->flags & HASH_NUMA) ? numa_home(table->numa, bucket) : 0;
+}
+
+int hash_getbuckets(hashtable_t* table, const int* keys, int* out, int n) {
+	if (!table || !keys || !out || n < 0)
+		return -1;
+	if (table->stopped) {
+		return -1;
+	}
+	hash_route(table, keys, out, n);
+	return n;
+}
+
+int hash_gethops(hashtable_t* table, unsigned long long* lookups,
+		unsigned long long* hops) {
+	if (!table || !lookups || !hops || !table->hop_stats)
+		return -1;
+	*lookups = *hops = 0;
+	for (int i = 0; i < HOP_STRIPES; ++i) {
+		*lookups += __atomic_load_n(&table->hop_stats[i].lookups,
+				__ATOMIC_RELAXED);
+		*hops += __atomic_load_n(&table->hop_stats[i].hops, __ATOMIC_RELAXED);
+	}
+	return 1;
+}
+
+int hash_getreseeds(hashtable_t* table) {
+	if (!table)
+		return -1;
+	return __atomic_load_n(&table->nr_reseeds, __ATOMIC_RELAXED);
+}
+
 typedef struct args_t {
 	Hashtable table;
 	Op op;
+	int bucket, generation; //route computed by hash_batch
 	bool* runThreads;
 }* Args;
 
@@ -478,29 +2506,13 @@ void* thread_routine(void* args) {
 	while (!(arguments->runThreads)) {
 	};
 
-	switch (arguments->op->op) {
-	case INSERT:
-		arguments->op->result = hash_insert(arguments->table,
-				arguments->op->key, arguments->op->val);
-		break;
-	case REMOVE:
-		arguments->op->result = hash_remove(arguments->table,
-				arguments->op->key);
-		break;
-	case CONTAINS:
-		arguments->op->result = hash_contains(arguments->table,
-				arguments->op->key);
-		break;
-	case UPDATE:
-		arguments->op->result = hash_update(arguments->table,
-				arguments->op->key, arguments->op->val);
-		break;
-	case COMPUTE:
-		arguments->op->result = list_node_compute(arguments->table,
-				arguments->op->key, arguments->op->compute_func,
-				&arguments->op->val);
-		break;
-	}
+	//same checks as the single op functions
+	Op op = arguments->op;
+	if (op->op == COMPUTE ? !op->compute_func : arguments->table->stopped)
+		op->result = -1;
+	else
+		hash_execute_routed(arguments->table, op, arguments->bucket,
+				arguments->generation, 0);
 
 	pthread_mutex_lock(&arguments->table->nr_threads_lock);
 	arguments->table->nr_threads--;
@@ -515,15 +2527,36 @@ void hash_batch(hashtable_t* table, int num_ops, op_t* ops) {
 	pthread_t threadArray[num_ops];
 	bool runThreads = false;
 
+	//route all the keys in one pass
+	int* keys = calloc(num_ops, sizeof(int));
+	int* buckets = malloc(sizeof(int) * num_ops);
+	int generation = -1;
+	if (keys && buckets) {
+		for (int i = 0; i < num_ops; ++i) {
+			keys[i] = ops[i].key;
+		}
+		generation = hash_route(table, keys, buckets, num_ops);
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
 	for (int i = 0; i < num_ops; ++i) {
 		Args args = malloc(sizeof(*args));
 		args->table = table;
 		args->op = ops + i;
+		args->bucket = (generation < 0) ? -1 : buckets[i];
+		args->generation = generation;
 		args->runThreads = &runThreads;
 
-		pthread_create(threadArray + i, NULL, thread_routine, args);
+		//on a cpu of the node that has the bucket
+		bool pinned = (table->flags & HASH_NUMA) && generation >= 0
+				&& numa_attr_pin(table->numa, numa_home(table->numa, buckets[i]),
+						&attr) == 0;
+		pthread_create(threadArray + i, pinned ? &attr : NULL, thread_routine,
+				args);
 
 	}
+	pthread_attr_destroy(&attr);
 
 	runThreads = true;
 
@@ -532,5 +2565,430 @@ void hash_batch(hashtable_t* table, int num_ops, op_t* ops) {
 		pthread_join(threadArray[i], retval);
 	}
 	free(retval);
+	free(keys);
+	free(buckets);
+
+}
+
+typedef struct stream_queue_t {
+	op_t ops[STREAM_QUEUE];
+	int head, count;
+} stream_queue_t;
+
+typedef struct stream_t {
+	Hashtable table;
+	int (*next)(void*, op_t*);
+	void (*done)(void*, op_t*);
+	void* ctx;
+	pthread_mutex_t next_lock, done_lock;
+	bool ended;
+	long executed;
+	int nr_queues; //HASH_NUMA: nodes with threads of their own
+	stream_queue_t* queues; //per node, ops waiting for a thread of the node
+}* Stream;
+
+typedef struct stream_thread_t {
+	pthread_t thread;
+	Stream stream;
+	int node; //-1 for the caller, who isn't pinned
+} stream_thread_t;
+
+static bool queue_push(stream_queue_t* queue, Op op) {
+	if (queue->count == STREAM_QUEUE)
+		return false;
+	queue->ops[(queue->head + queue->count++) % STREAM_QUEUE] = *op;
+	return true;
+}
+
+static bool queue_pop(stream_queue_t* queue, Op op) {
+	if (!queue->count)
+		return false;
+	*op = queue->ops[queue->head];
+	queue->head = (queue->head + 1) % STREAM_QUEUE;
+	queue->count--;
+	return true;
+}
+
+/*
+ * Auxiliary function:
+ * the next op for a thread of the node, called with next_lock held.
+ * An op the producer hands out for another node waits in the queue of
+ * that node, unless it is full. Returns false once the producer is done
+ * and no op waits anymore.
+ */
+static bool stream_take(Stream stream, int node, Op op) {
+	if (node >= 0 && queue_pop(&stream->queues[node], op))
+		return true;
+	while (!stream->ended) {
+		if (stream->table->stopped || stream->next(stream->ctx, op) != 1) {
+			stream->ended = true;
+			break;
+		}
+		if (!stream->nr_queues)
+			return true;
+		int bucket = hash_getbucket(stream->table, op->key);
+		int home = bucket < 0 ? -1 : numa_home(stream->table->numa, bucket);
+		if (home < 0 || home == node || home >= stream->nr_queues
+				|| !queue_push(&stream->queues[home], op))
+			return true;
+	}
+	//help with the ops still waiting
+	for (int n = 0; n < stream->nr_queues; ++n) {
+		if (queue_pop(&stream->queues[n], op))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Auxiliary function:
+ * a thread of hash_batch_stream: takes the next op only once the last
+ * one is done, so the producer can't get ahead of the threads
+ */
+static void* stream_worker(void* arg) {
+	stream_thread_t* self = arg;
+	Stream stream = self->stream;
+	Hashtable table = stream->table;
+	pthread_mutex_lock(&table->nr_threads_lock);
+	table->nr_threads++;
+	pthread_mutex_unlock(&table->nr_threads_lock);
+
+	op_t op;
+	long executed = 0;
+	while (true) {
+		pthread_mutex_lock(&stream->next_lock);
+		bool taken = stream_take(stream, self->node, &op);
+		pthread_mutex_unlock(&stream->next_lock);
+		if (!taken)
+			break;
+
+		//same checks as the single op functions
+		if ((op.op == COMPUTE && !op.compute_func) || table->stopped)
+			op.result = -1;
+		else
+			hash_execute(table, &op);
+		executed++;
+		if (stream->done) {
+			pthread_mutex_lock(&stream->done_lock);
+			stream->done(stream->ctx, &op);
+			pthread_mutex_unlock(&stream->done_lock);
+		}
+	}
+	__atomic_add_fetch(&stream->executed, executed, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&table->nr_threads_lock);
+	table->nr_threads--;
+	pthread_mutex_unlock(&table->nr_threads_lock);
+	return NULL;
+}
+
+long hash_batch_stream(hashtable_t* table, int nthreads,
+		int (*next)(void* ctx, op_t* op), void (*done)(void* ctx, op_t* op),
+		void* ctx) {
+	if (!table || !next || nthreads < 1)
+		return -1;
+	if (table->stopped) {
+		return -1;
+	}
+
+	struct stream_t stream = { .table = table, .next = next, .done = done,
+			.ctx = ctx };
+	//the threads but the caller are spread over the nodes
+	if ((table->flags & HASH_NUMA) && nthreads > 1) {
+		stream.nr_queues = numa_nodes(table->numa);
+		if (stream.nr_queues > nthreads - 1)
+			stream.nr_queues = nthreads - 1;
+		if ((stream.queues = calloc(stream.nr_queues, sizeof(stream_queue_t)))
+				== NULL)
+			stream.nr_queues = 0;
+	}
+	pthread_mutex_init(&stream.next_lock, NULL);
+	pthread_mutex_init(&stream.done_lock, NULL);
+	//not on the stack, nthreads comes from the caller
+	stream_thread_t* threads = malloc(sizeof(stream_thread_t) * nthreads);
+	stream_thread_t caller = { .stream = &stream, .node = -1 };
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	int started = 0;
+	for (int i = 1; i < nthreads && threads; ++i) {
+		stream_thread_t* thread = &threads[started];
+		thread->stream = &stream;
+		thread->node = stream.nr_queues ? (i - 1) % stream.nr_queues : -1;
+		bool pinned = thread->node >= 0
+				&& numa_attr_pin(table->numa, thread->node, &attr) == 0;
+		if (pthread_create(&thread->thread, pinned ? &attr : NULL,
+				stream_worker, thread) == 0)
+			started++;
+	}
+	pthread_attr_destroy(&attr);
+	stream_worker(&caller);
+	for (int i = 0; i < started; ++i) {
+		pthread_join(threads[i].thread, NULL);
+	}
+	free(threads);
+	free(stream.queues);
+	pthread_mutex_destroy(&stream.next_lock);
+	pthread_mutex_destroy(&stream.done_lock);
+	return stream.executed;
+}
+
+hash_iter_t* hash_iter_begin(hashtable_t* table) {
+	if (!table || table->stopped || table->cuckoo || table->shm)
+		return NULL;
+	hash_iter_t* iter = calloc(1, sizeof(*iter));
+	if (!iter)
+		return NULL;
+	iter->table = table;
+	return iter;
+}
+
+int hash_iter_next(hash_iter_t* iter, int* key, void* val) {
+	if (!iter || !key || !val)
+		return -1;
+	Hashtable table = iter->table;
+	while (iter->pos == iter->count) {
+		if (iter->bucket == table->nr_buckets)
+			return 0;
+		bool reseed = table->flags & HASH_AUTO_RESEED;
+		if (reseed)
+			pthread_rwlock_rdlock(&table->resize_lock);
+		if (table->bucket_rw)
+			pthread_rwlock_rdlock(&table->bucket_rw[iter->bucket]);
+		int res = iter_load(iter, iter->bucket);
+		if (table->bucket_rw)
+			pthread_rwlock_unlock(&table->bucket_rw[iter->bucket]);
+		if (reseed)
+			pthread_rwlock_unlock(&table->resize_lock);
+		if (res < 0)
+			return -1;
+		iter->bucket++;
+	}
+
+	int width = iter_width(table);
+	*key = iter->keys[iter->pos];
+	memcpy(val, iter->values + (size_t) width * iter->pos, width);
+	iter->pos++;
+	return 1;
+}
+
+void hash_iter_end(hash_iter_t* iter) {
+	if (!iter)
+		return;
+	free(iter->keys);
+	free(iter->values);
+	free(iter);
+}
+
+long hash_parallel_foreach(hashtable_t* table, void (*fn)(int, void*),
+		int nthreads) {
+	if (!table || !fn || nthreads < 1)
+		return -1;
+	if (table->stopped || table->cuckoo || table->shm) {
+		return -1;
+	}
+	struct pass_t pass = { .visit = list_foreach, .fn = fn };
+	return buckets_parallel(table, nthreads, &pass);
+}
+
+long hash_compute_all(hashtable_t* table, void* (*fn)(void*), int nthreads) {
+	if (!table || !fn || nthreads < 1)
+		return -1;
+	if (table->stopped || table->cuckoo || table->shm) {
+		return -1;
+	}
+	struct pass_t pass = { .visit = list_foreach, .compute = fn };
+	return buckets_parallel(table, nthreads, &pass);
+}
+
+int hash_feed_read(hashtable_t* table, hash_change_t* out, int max,
+		unsigned long long* dropped) {
+	if (!table || !out || max < 0 || !dropped)
+		return -1;
+	if (!table->feed) {
+		return -1;
+	}
+	Feed feed = table->feed;
+	pthread_mutex_lock(&feed->read_lock);
+
+	//every change below limit is in a ring already, or was dropped
+	unsigned long long limit = __atomic_load_n(&feed->seq, __ATOMIC_SEQ_CST);
+	FeedRing rings = __atomic_load_n(&feed->rings, __ATOMIC_ACQUIRE);
+	for (FeedRing ring = rings; ring; ring = ring->next) {
+		unsigned long long pending = __atomic_load_n(&ring->pending,
+				__ATOMIC_SEQ_CST);
+		if (pending < limit)
+			limit = pending;
+	}
 
+	//merge the rings by sequence number
+	int n = 0;
+	while (n < max) {
+		FeedRing first = NULL;
+		hash_change_t* next = NULL;
+		for (FeedRing ring = rings; ring; ring = ring->next) {
+			if (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+				continue;
+			hash_change_t* record = &ring->records[ring->head & (feed->size - 1)];
+			if (record->seq < limit && (!next || record->seq < next->seq)) {
+				first = ring;
+				next = record;
+			}
+		}
+		if (!next)
+			break;
+		*dropped += next->seq - feed->expected;
+		feed->expected = next->seq + 1;
+		out[n++] = *next;
+		__atomic_store_n(&first->head, first->head + 1, __ATOMIC_RELEASE);
+	}
+	//whatever is missing below limit was dropped
+	if (n < max && feed->expected < limit) {
+		*dropped += limit - feed->expected;
+		feed->expected = limit;
+	}
+
+	pthread_mutex_unlock(&feed->read_lock);
+	return n;
+}
+
+int hash_checkpoint(hashtable_t* table, int fd) {
+	if (!table || fd < 0)
+		return -1;
+	if (table->stopped || !table->dirty) {
+		return -1;
+	}
+	CkptWriter writer = malloc(sizeof(*writer));
+	if (!writer)
+		return -1;
+	writer->fd = fd;
+	writer->failed = 0;
+	writer->used = 0;
+	struct hash_iter_t iter = { .table = table };
+
+	//bucket indexes stay meaningful for the whole checkpoint
+	bool reseed = table->flags & HASH_AUTO_RESEED;
+	if (reseed)
+		pthread_rwlock_rdlock(&table->resize_lock);
+	pthread_mutex_lock(&table->checkpoint_lock);
+	bool full = table->checkpoint_full;
+	table->checkpoint_full = 0;
+	checkpoint_header_t header = { CHECKPOINT_MAGIC, full, table->nr_buckets,
+			table->value_size, ++table->checkpoints };
+	ckpt_put(writer, &header, sizeof(header));
+
+	int written = 0;
+	for (int bucket = 0; bucket < table->nr_buckets && !writer->failed;
+			++bucket) {
+		//cleared before the copy, a change racing with it dirties it again
+		if (!__atomic_exchange_n(&table->dirty[bucket], 0, __ATOMIC_ACQUIRE)
+				&& !full)
+			continue;
+		if (table->bucket_rw)
+			pthread_rwlock_rdlock(&table->bucket_rw[bucket]);
+		int res = iter_load(&iter, bucket);
+		if (table->bucket_rw)
+			pthread_rwlock_unlock(&table->bucket_rw[bucket]);
+		if (res < 0) {
+			writer->failed = 1;
+			break;
+		}
+		//a base image leaves the empty buckets out
+		if (full && iter.count == 0)
+			continue;
+		ckpt_put_bucket(writer, &iter, bucket);
+		written++;
+	}
+	checkpoint_bucket_t end = { -1, 0 };
+	ckpt_put(writer, &end, sizeof(end));
+	ckpt_flush(writer);
+	//the buckets cleared above may be missing, start over from a base
+	if (writer->failed)
+		table->checkpoint_full = 1;
+	pthread_mutex_unlock(&table->checkpoint_lock);
+	if (reseed)
+		pthread_rwlock_unlock(&table->resize_lock);
+
+	int failed = writer->failed;
+	free(iter.keys);
+	free(iter.values);
+	free(writer);
+	return failed ? -1 : written;
+}
+
+long hash_checkpoint_compact(int in_fd, int out_fd) {
+	if (in_fd < 0 || out_fd < 0)
+		return -1;
+	ckpt_image_t image;
+	if (image_read(in_fd, &image) < 0) {
+		image_free(&image);
+		return -1;
+	}
+	CkptWriter writer = malloc(sizeof(*writer));
+	if (!writer) {
+		image_free(&image);
+		return -1;
+	}
+	writer->fd = out_fd;
+	writer->failed = 0;
+	writer->used = 0;
+
+	checkpoint_header_t header = image.header;
+	header.full = 1;
+	ckpt_put(writer, &header, sizeof(header));
+	size_t entry = sizeof(int32_t) + (size_t) header.value_size;
+	long entries = 0;
+	for (int bucket = 0; bucket < header.nr_buckets; ++bucket) {
+		unsigned char* record = image.buckets[bucket];
+		if (!record)
+			continue;
+		checkpoint_bucket_t head = { .bucket = bucket };
+		memcpy(&head.count, record, sizeof(int32_t));
+		ckpt_put(writer, &head, sizeof(head));
+		ckpt_put(writer, record + sizeof(int32_t), entry * head.count);
+		entries += head.count;
+	}
+	checkpoint_bucket_t end = { -1, 0 };
+	ckpt_put(writer, &end, sizeof(end));
+	ckpt_flush(writer);
+
+	int failed = writer->failed;
+	image_free(&image);
+	free(writer);
+	return failed ? -1 : entries;
+}
+
+long hash_restore(hashtable_t* table, int fd) {
+	if (!table || fd < 0)
+		return -1;
+	if (table->stopped) {
+		return -1;
+	}
+	ckpt_image_t image;
+	if (image_read(fd, &image) < 0
+			|| image.header.value_size != table->value_size) {
+		image_free(&image);
+		return -1;
+	}
+
+	int width = iter_width(table);
+	long restored = 0;
+	for (int bucket = 0; bucket < image.header.nr_buckets; ++bucket) {
+		unsigned char* record = image.buckets[bucket];
+		if (!record)
+			continue;
+		int32_t count;
+		memcpy(&count, record, sizeof(count));
+		unsigned char* entry = record + sizeof(int32_t);
+		for (int i = 0; i < count; ++i, entry += sizeof(int32_t) + width) {
+			int32_t key;
+			memcpy(&key, entry, sizeof(key));
+			//the values are inline, copied in from the record
+			void* val = entry + sizeof(int32_t);
+			if (hash_insert(table, key, val) == 0)
+				hash_update(table, key, val);
+			restored++;
+		}
+	}
+	image_free(&image);
+	return restored;
 }
@@ -16,21 +16,254 @@ typedef struct op_t
 {
     int key;
     void *val;
-    enum {INSERT, REMOVE, CONTAINS, UPDATE, COMPUTE} op;
+    enum {INSERT, REMOVE, CONTAINS, UPDATE, COMPUTE, GET} op;
     void *(*compute_func) (void *);
     int result;
+    /*
+     * INSERT and UPDATE on HASH_TTL tables: the entry expires ttl_ms from
+     * now. 0 never expires on INSERT and keeps the old expiry on UPDATE.
+     * Other tables ignore it.
+     */
+    long ttl_ms;
 } op_t;
 
+/* hash_opts_t flags */
+#define HASH_FLAT_COMBINING 0x1 /* ops on a bucket are executed by one combiner thread */
+#define HASH_TRANSACTIONS   0x2 /* enables hash_transaction */
+#define HASH_AUTO_RESEED    0x4 /* rehash with a new seed when a chain gets too long, built-in hash only */
+#define HASH_POW2_BUCKETS   0x8 /* round buckets up to a power of two and use inlined fibonacci hashing, built-in hash only */
+#define HASH_CUCKOO         0x10 /* bucketized cuckoo engine, buckets of 4 slots, at most two probes per lookup; no other flag */
+#define HASH_TTL            0x20 /* entries may expire, a background thread sweeps them out */
+#define HASH_TOMBSTONES     0x40 /* remove only marks the node, the background thread unlinks and frees it */
+#define HASH_CHANGE_FEED    0x80 /* every change is appended to a feed read with hash_feed_read */
+#define HASH_CHECKPOINT     0x100 /* changed buckets are tracked for hash_checkpoint; needs a value_size */
+#define HASH_NUMA           0x200 /* buckets, their nodes and the batch threads working on them are placed on NUMA nodes */
+#define HASH_HUGE_PAGES     0x400 /* bucket arrays and nodes in 2MB pages: reserved ones, else transparent ones (2MB per array at least) */
+#define HASH_TRANSPOSE      0x800 /* an entry found more often than the one before it in its chain trades places with it */
+#define HASH_HOP_STATS      0x1000 /* counts the nodes walked to find keys, see hash_gethops */
+#define HASH_BLOOM          0x2000 /* a counting filter per bucket fails most ops on absent keys without walking the chain */
+
+#define HASH_DEFAULT_MAX_CHAIN 16
+#define HASH_DEFAULT_SWEEP_MS  100
+#define HASH_DEFAULT_FEED_SIZE 256
+
+/*
+ * Passing a NULL hash to hash_alloc_opts selects the built-in seeded hash.
+ */
+typedef struct hash_opts_t
+{
+    int flags;
+    unsigned long long seed; /* built-in hash seed, 0 for a random one */
+    int max_chain;           /* chain length that triggers a reseed, 0 for the default */
+    /* optional batch version of hash, fills out[i] with the bucket of keys[i] */
+    void (*hash_many)(int buckets, const int *keys, int *out, int n);
+    /*
+     * bytes of value stored inside each node, 0 to store the void* itself.
+     * insert and update then copy value_size bytes from val, compute gets
+     * a pointer to the stored bytes.
+     */
+    int value_size;
+    /*
+     * capacity in entries and/or bytes (node plus inline value), 0 for
+     * unbounded. Inserts past it evict entries with CLOCK, evict is then
+     * called to release the value.
+     */
+    int capacity;
+    long capacity_bytes;
+    void (*evict)(int key, void *val); /* also called for expired entries */
+    /*
+     * HASH_TTL, HASH_TOMBSTONES: pause between two sweeper steps, 0 for
+     * the default. The sweeper goes over every bucket within 16 steps.
+     */
+    int sweep_ms;
+    int feed_size; /* HASH_CHANGE_FEED: records buffered per writing thread, 0 for the default */
+    /*
+     * HASH_NUMA: 0 for the nodes of the machine. Any other number simulates
+     * that many nodes on the cpus the process may use, without binding the
+     * memory, to try the placement out on one socket.
+     */
+    int numa_nodes;
+} hash_opts_t;
+
+/*
+ * One change of a HASH_CHANGE_FEED table. Sequence numbers follow the
+ * order the changes were applied in. Evicted and expired entries show up
+ * as REMOVE.
+ */
+typedef struct hash_change_t
+{
+    unsigned long long seq;
+    int key;
+    int op;    /* INSERT, REMOVE, UPDATE or COMPUTE */
+    void *val; /* the void* value after the change, NULL for REMOVE and inline values */
+} hash_change_t;
+
 hashtable_t* hash_alloc(int buckets, int (*hash)(int, int));
+hashtable_t* hash_alloc_opts(int buckets, int (*hash)(int, int),
+                             const hash_opts_t* opts);
+/* hash_alloc_opts with HASH_POW2_BUCKETS and the built-in hash */
+hashtable_t* hash_alloc_fast(int buckets);
+/*
+ * Table in the POSIX shared memory object name (see shm_open), shared by
+ * every process that allocates it with the same buckets, value_size and
+ * capacity; the first one creates it. Values are stored inline, capacity
+ * is the size of the node arena and inserts fail with -1 once it is full.
+ * No flags. hash must map keys the same way in all the processes.
+ * hash_free only detaches, hash_unlink_shm removes the name.
+ */
+hashtable_t* hash_alloc_shm(const char* name, int buckets,
+                            int (*hash)(int, int), const hash_opts_t* opts);
+int hash_unlink_shm(const char* name);
 int hash_stop(hashtable_t* table);
 int hash_free(hashtable_t* table);
 int hash_insert(hashtable_t* table, int key, void *val);
 int hash_update(hashtable_t* table, int key, void *val);
+/* HASH_TTL tables: the entry is treated as absent ttl_ms after the call */
+int hash_insert_ttl(hashtable_t* table, int key, void *val, long ttl_ms);
+int hash_update_ttl(hashtable_t* table, int key, void *val, long ttl_ms);
 int hash_remove(hashtable_t* table, int key);
 int hash_contains(hashtable_t* table, int key);
+/* copies the value out: value_size bytes, or the void* itself */
+int hash_get(hashtable_t* table, int key, void* out);
 int list_node_compute(hashtable_t* table, int key,
                       void *(*compute_func) (void *), void** result);
+/*
+ * Non-blocking variants: where the op above would wait for a lock on the
+ * way to the key - a node or bucket lock held by another op, a running
+ * reseed or transaction - they return HASH_BUSY and leave the table as
+ * it was. Not for HASH_CUCKOO or shared memory tables (-1). Ops on a
+ * HASH_FLAT_COMBINING table walk the bucket themselves. An insert evicts
+ * only from the buckets it can lock, and leaves a reseed it triggers to
+ * the next op that may wait.
+ */
+#define HASH_BUSY (-2)
+int hash_try_insert(hashtable_t* table, int key, void *val);
+int hash_try_update(hashtable_t* table, int key, void *val);
+int hash_try_remove(hashtable_t* table, int key);
+int hash_try_contains(hashtable_t* table, int key);
+int hash_try_get(hashtable_t* table, int key, void* out);
+int hash_try_compute(hashtable_t* table, int key,
+                     void *(*compute_func) (void *), void** result);
+/*
+ * Executes op like hash_batch does, waiting at most timeout_us microseconds
+ * for the locks on the way (0 only tries them), returns op->result:
+ * HASH_BUSY if the time ran out.
+ */
+int hash_execute_timed(hashtable_t* table, op_t* op, long timeout_us);
 int hash_getbucketsize(hashtable_t* table, int bucket);
+int hash_getbucket(hashtable_t* table, int key);
+/*
+ * HASH_NUMA tables: the node whose memory has the bucket, its slice of the
+ * bucket arrays and the nodes inserted into it; 0 for other tables.
+ * Every node has a contiguous range of buckets whose slice of each bucket
+ * array is whole pages: a multiple of 4096 buckets, or of 524288 buckets
+ * (2MB of 4 byte entries) with HASH_HUGE_PAGES. The last nodes get fewer
+ * buckets, or none, when the table is small.
+ */
+int hash_getnode(hashtable_t* table, int bucket);
+/* buckets of n keys at once (vectorized for the built-in hash), returns n */
+int hash_getbuckets(hashtable_t* table, const int* keys, int* out, int n);
+int hash_getreseeds(hashtable_t* table);
+/*
+ * HASH_HOP_STATS tables: the walks that found their key, by any op, and
+ * the nodes they went through, the key's included. Returns -1 without it.
+ */
+int hash_gethops(hashtable_t* table, unsigned long long* lookups,
+                 unsigned long long* hops);
 void hash_batch(hashtable_t* table, int num_ops, op_t* ops);
+/*
+ * hash_batch for streams of any length: nthreads threads, the caller being
+ * one of them, execute the ops next fills in until it returns 0 or the
+ * table is stopped. A thread asks for an op only once its last one is
+ * done, so at most nthreads ops are in flight and next runs at the pace
+ * of the table. done, if not NULL, gets every op with its result as soon
+ * as it ran (COMPUTE stores the compute result in op->val); the op is
+ * reused once done returns. Calls to next are serialized, and so are the
+ * calls to done. Returns the number of ops executed, -1 on bad arguments.
+ * With HASH_NUMA the threads but the caller are pinned to the nodes in
+ * turn, and an op is handed to a thread of the node that has its bucket;
+ * up to 16 ops per node may then wait for one, on top of those in flight.
+ */
+long hash_batch_stream(hashtable_t* table, int nthreads,
+                       int (*next)(void* ctx, op_t* op),
+                       void (*done)(void* ctx, op_t* op), void* ctx);
+/*
+ * Runs all the ops atomically: returns 1 if all of them committed, 0 if one
+ * would have failed and nothing was applied - that op gets result 0 and the
+ * others -1. CONTAINS never aborts. Needs a table with HASH_TRANSACTIONS.
+ * -1 if the table couldn't take the ops: nothing was applied either.
+ */
+int hash_transaction(hashtable_t* table, int num_ops, op_t* ops);
+
+/*
+ * Consumes up to max changes in sequence order, returns how many. Changes
+ * a writer couldn't buffer because the reader fell behind are lost; their
+ * count is added to *dropped. One reader at a time.
+ */
+int hash_feed_read(hashtable_t* table, hash_change_t* out, int max,
+                   unsigned long long* dropped);
+
+/*
+ * HASH_CHECKPOINT tables: appends to fd the buckets changed since the last
+ * checkpoint, next to concurrent ops, so the cost follows the write rate
+ * and not the table size. The first checkpoint, and the first one after a
+ * reseed, is a base image of every bucket. Each bucket is copied under its
+ * locks like hash_iter does; values are saved as hash_get copies them out,
+ * expiry times are not saved. One checkpoint at a time. Only tables with
+ * a value_size take checkpoints: a void* value would dangle in the process
+ * that restores it.
+ * Returns the number of buckets written, or -1 - then what was appended is
+ * incomplete and the next checkpoint is a base image again.
+ */
+int hash_checkpoint(hashtable_t* table, int fd);
+/*
+ * Merges the checkpoints read from in_fd, a base image and the deltas that
+ * followed it, into one base image appended to out_fd. Returns the number
+ * of entries in it, -1 on error.
+ */
+long hash_checkpoint_compact(int in_fd, int out_fd);
+/*
+ * inserts, or updates, the entries of the checkpoints read from fd, returns
+ * how many or -1. The table must have the value_size of the checkpoints.
+ */
+long hash_restore(hashtable_t* table, int fd);
+
+/*
+ * Weakly consistent iteration, safe next to concurrent ops and without a
+ * global lock: one bucket at a time is copied out under its locks. Every
+ * entry that stays in the table for the whole walk is returned exactly
+ * once, unless the table reseeds meanwhile; entries added or removed
+ * during the walk may or may not be returned. Not for HASH_CUCKOO or
+ * shared memory tables.
+ */
+struct hash_iter_t;
+typedef struct hash_iter_t hash_iter_t;
+
+hash_iter_t* hash_iter_begin(hashtable_t* table);
+/* returns 1 and the next entry (value copied like hash_get), 0 at the end */
+int hash_iter_next(hash_iter_t* iter, int* key, void* val);
+void hash_iter_end(hash_iter_t* iter);
+/*
+ * Calls fn on every entry, nthreads threads share the buckets (at most one
+ * per cpu). fn runs under the node lock and must not call back into the
+ * table. Entries are seen exactly once, with the same guarantee as
+ * hash_iter for concurrent ops.
+ * Returns the number of entries visited.
+ */
+long hash_parallel_foreach(hashtable_t* table, void (*fn)(int key, void *val),
+                           int nthreads);
+/*
+ * Transforms every value on nthreads threads, at most one per cpu. fn
+ * gets the value like list_node_compute and returns the new one: void*
+ * values are replaced by what fn returns, inline values are changed in
+ * place by fn.
+ * Every entry is transformed under its node lock, so it is atomic against
+ * single key ops on the same key, and every entry that stays in the table
+ * for the whole call is transformed exactly once. It is not a snapshot:
+ * entries inserted during the call may or may not be transformed, and a
+ * concurrent hash_transaction may be seen transformed on some of its keys
+ * only. Returns the number of entries transformed.
+ */
+long hash_compute_all(hashtable_t* table, void *(*fn)(void *), int nthreads);
 
 #endif /* HASHTABLE_H_ */
@@ -0,0 +1,138 @@
+/*
+ * lock.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Slow paths of lock.h: the futex protocol is the three state mutex of
+ * Drepper's "Futexes Are Tricky", with a bounded spin in front of it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "lock.h"
+
+#define LOCK_SPINS 64 //polls of a held lock before parking
+#define LOCK_MAX_BACKOFF 64 //pauses between two polls
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static void futex(uint32_t* address, int op, uint32_t value,
+		const struct timespec* timeout) {
+	syscall(SYS_futex, address, op, value, timeout, NULL, 0);
+}
+
+/*
+ * Auxiliary function:
+ * spins while the holder may let go soon, returns true if it got the lock
+ */
+static bool lock_spin(lock_t* lock) {
+	//on one cpu the holder can't run while we spin
+	static int spins = -1;
+	int limit = __atomic_load_n(&spins, __ATOMIC_RELAXED);
+	if (limit < 0) {
+		limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? LOCK_SPINS : 0;
+		__atomic_store_n(&spins, limit, __ATOMIC_RELAXED);
+	}
+
+	int backoff = 1;
+	for (int spin = 0; spin < limit; ++spin) {
+		uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+		//somebody sleeps already, spinning would only overtake it
+		if (state == LOCK_PARKED)
+			return false;
+		if (state == LOCK_FREE) {
+			uint32_t expected = LOCK_FREE;
+			if (__atomic_compare_exchange_n(&lock->state, &expected, LOCK_HELD,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return true;
+		}
+		for (int i = 0; i < backoff; ++i) {
+			cpu_relax();
+		}
+		if (backoff < LOCK_MAX_BACKOFF)
+			backoff <<= 1;
+	}
+	return false;
+}
+
+/*
+ * Called when the fast path found the lock held. Spins while the holder
+ * may let go soon, then marks the lock LOCK_PARKED and sleeps until the
+ * release wakes it up. A thread that ever parked takes the lock as
+ * LOCK_PARKED, so its own release wakes the next sleeper.
+ */
+void lock_contended(lock_t* lock) {
+	if (lock_spin(lock))
+		return;
+	while (__atomic_exchange_n(&lock->state, LOCK_PARKED, __ATOMIC_ACQUIRE)
+			!= LOCK_FREE) {
+		futex(&lock->state, FUTEX_WAIT_PRIVATE, LOCK_PARKED, NULL);
+	}
+}
+
+/*
+ * lock_contended with a deadline: the sleeps are cut at deadline_ns.
+ * Giving up leaves the lock LOCK_PARKED, which only costs its holder a
+ * wake up nobody waits for.
+ */
+bool lock_contended_until(lock_t* lock, uint64_t deadline_ns) {
+	if (lock_spin(lock))
+		return true;
+	while (__atomic_exchange_n(&lock->state, LOCK_PARKED, __ATOMIC_ACQUIRE)
+			!= LOCK_FREE) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t now_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+		if (now_ns >= deadline_ns)
+			return false;
+		uint64_t left = deadline_ns - now_ns;
+		struct timespec timeout = { left / 1000000000ULL, left % 1000000000ULL };
+		futex(&lock->state, FUTEX_WAIT_PRIVATE, LOCK_PARKED, &timeout);
+	}
+	return true;
+}
+
+void lock_wake(lock_t* lock) {
+	futex(&lock->state, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+#ifdef LOCK_DEBUG
+static __thread char lock_self; //its address tells the threads apart
+
+void lock_check_acquire(lock_t* lock) {
+	if (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED)
+			== (uintptr_t) &lock_self) {
+		fprintf(stderr, "lock %p: locked twice by the same thread\n",
+				(void*) lock);
+		abort();
+	}
+}
+
+void lock_owned(lock_t* lock) {
+	__atomic_store_n(&lock->owner, (uintptr_t) &lock_self, __ATOMIC_RELAXED);
+}
+
+void lock_check_release(lock_t* lock) {
+	if (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED)
+			!= (uintptr_t) &lock_self) {
+		fprintf(stderr, "lock %p: unlocked by a thread that doesn't hold it\n",
+				(void*) lock);
+		abort();
+	}
+	__atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+}
+#endif
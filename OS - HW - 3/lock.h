@@ -0,0 +1,97 @@
+/*
+ * lock.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Lock of the nodes and the buckets of hashtable.c. The hand-over-hand
+ * walks hold a lock for a few nanoseconds, so a contended lock first spins
+ * with exponential backoff and only then parks on a futex.
+ * It takes 4 bytes. Unless NDEBUG is defined it also records its owner,
+ * and aborts on the misuses an error checking mutex reports: locking it
+ * twice and unlocking it from a thread that doesn't hold it.
+ * lock_try and lock_acquire_until give up instead of waiting for ever.
+ */
+
+#ifndef LOCK_H_
+#define LOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef NDEBUG
+#define LOCK_DEBUG
+#endif
+
+typedef struct lock_t {
+	uint32_t state; //LOCK_FREE, LOCK_HELD or LOCK_PARKED
+#ifdef LOCK_DEBUG
+	uintptr_t owner;
+#endif
+} lock_t;
+
+enum {
+	LOCK_FREE, LOCK_HELD, LOCK_PARKED //held and somebody may sleep on it
+};
+
+void lock_contended(lock_t* lock);
+bool lock_contended_until(lock_t* lock, uint64_t deadline_ns);
+void lock_wake(lock_t* lock);
+#ifdef LOCK_DEBUG
+void lock_check_acquire(lock_t* lock);
+void lock_owned(lock_t* lock);
+void lock_check_release(lock_t* lock);
+#else
+#define lock_check_acquire(lock) ((void) 0)
+#define lock_owned(lock) ((void) 0)
+#define lock_check_release(lock) ((void) 0)
+#endif
+
+static inline void lock_init(lock_t* lock) {
+	lock->state = LOCK_FREE;
+#ifdef LOCK_DEBUG
+	lock->owner = 0;
+#endif
+}
+
+static inline void lock_acquire(lock_t* lock) {
+	lock_check_acquire(lock);
+	uint32_t expected = LOCK_FREE;
+	if (!__atomic_compare_exchange_n(&lock->state, &expected, LOCK_HELD, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		lock_contended(lock);
+	lock_owned(lock);
+}
+
+static inline bool lock_try(lock_t* lock) {
+	uint32_t expected = LOCK_FREE;
+	if (!__atomic_compare_exchange_n(&lock->state, &expected, LOCK_HELD, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return false;
+	lock_owned(lock);
+	return true;
+}
+
+/*
+ * lock_acquire giving up at deadline_ns, a CLOCK_MONOTONIC time:
+ * returns false, without the lock, if it is still held then
+ */
+static inline bool lock_acquire_until(lock_t* lock, uint64_t deadline_ns) {
+	lock_check_acquire(lock);
+	uint32_t expected = LOCK_FREE;
+	if (!__atomic_compare_exchange_n(&lock->state, &expected, LOCK_HELD, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+			&& !lock_contended_until(lock, deadline_ns))
+		return false;
+	lock_owned(lock);
+	return true;
+}
+
+static inline void lock_release(lock_t* lock) {
+	lock_check_release(lock);
+	if (__atomic_exchange_n(&lock->state, LOCK_FREE, __ATOMIC_RELEASE)
+			== LOCK_PARKED)
+		lock_wake(lock);
+}
+
+#endif /* LOCK_H_ */
@@ -0,0 +1,338 @@
+/*
+ * numa.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ */
+
+#define _GNU_SOURCE //cpu_set_t, pthread_attr_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "numa.h"
+#include "lock.h"
+
+#define NUMA_SHARDS 8 //arenas per node, the threads are spread over them
+#define NUMA_CHUNK (2 * 1024 * 1024) //bytes an arena maps at once
+#define NUMA_CHUNK_HEADER 64 //links the chunks of an arena, keeps the blocks aligned
+#define NUMA_SPAN_ALIGN 4096 //buckets, every slice of a bucket array is whole pages
+#define NUMA_HUGE_PAGE (2 * 1024 * 1024)
+#define NUMA_MASK_BITS 1024 //node ids mbind can be given
+
+/*
+ * Fixed size blocks of one node: the freed ones are reused first, then
+ * the rest of the last chunk is handed out
+ */
+typedef struct numa_arena_t {
+	_Alignas(64) lock_t lock;
+	void* free_list; //linked by their first word
+	char* unused;
+	char* end;
+	void* chunks; //linked by their first word
+} numa_arena_t;
+
+struct numa_t {
+	int nodes;
+	bool bound; //the nodes are the machine's and memory is bound to them
+	bool huge; //memory is mapped in 2MB pages
+	int ids[NUMA_MAX_NODES]; //kernel ids of the nodes
+	cpu_set_t cpus[NUMA_MAX_NODES];
+	size_t count, span; //buckets, and buckets per node
+	size_t block_size, chunk_size;
+	numa_arena_t arenas[]; //NUMA_SHARDS per node
+};
+
+//-----------------------------------------------------//
+//Auxiliary functions:
+
+/*
+ * Auxiliary function:
+ * parses a sysfs list like "0-3,8,10-11" into ids, returns how many or -1
+ */
+static int read_list(const char* path, int* ids, int max) {
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return -1;
+	char line[4096];
+	bool ok = fgets(line, sizeof(line), file) != NULL;
+	fclose(file);
+	if (!ok)
+		return -1;
+
+	int n = 0;
+	char* cursor = line;
+	while (*cursor && *cursor != '\n') {
+		char* end;
+		long first = strtol(cursor, &end, 10);
+		long last = first;
+		if (end == cursor || first < 0)
+			return -1;
+		if (*end == '-') {
+			cursor = end + 1;
+			last = strtol(cursor, &end, 10);
+			if (end == cursor || last < first)
+				return -1;
+		}
+		for (long id = first; id <= last; ++id) {
+			if (n == max)
+				return n;
+			ids[n++] = id;
+		}
+		cursor = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+/*
+ * Auxiliary function:
+ * prefers the node for the pages of [address, address + len), if the
+ * kernel refuses they stay wherever they are first touched
+ */
+static void bind_node(numa_t* numa, void* address, size_t len, int node) {
+	if (!numa->bound || numa->ids[node] >= NUMA_MASK_BITS)
+		return;
+	unsigned long mask[NUMA_MASK_BITS / (8 * sizeof(unsigned long))] = { 0 };
+	int id = numa->ids[node];
+	mask[id / (8 * sizeof(unsigned long))] |=
+			1UL << (id % (8 * sizeof(unsigned long)));
+	syscall(SYS_mbind, address, len, MPOL_PREFERRED, mask, NUMA_MASK_BITS + 1,
+			0);
+}
+
+static size_t page_round(size_t bytes) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (bytes + page - 1) / page * page;
+}
+
+static size_t region_size(numa_t* numa, size_t bytes) {
+	if (numa->huge)
+		return (bytes + NUMA_HUGE_PAGE - 1) & ~(size_t) (NUMA_HUGE_PAGE - 1);
+	return page_round(bytes);
+}
+
+/*
+ * Auxiliary function:
+ * zeroed memory for the arrays and the arenas. With huge pages it comes
+ * from the reserved huge pages, or else it is 2MB aligned memory the
+ * kernel is asked to back with transparent huge pages.
+ */
+static void* region_map(numa_t* numa, size_t bytes) {
+	size_t len = region_size(numa, bytes);
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	char* region;
+	if (numa->huge) {
+		region = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+				-1, 0);
+		if (region != MAP_FAILED)
+			return region;
+		//only whole aligned 2MB ranges can be collapsed, trim what's around one
+		char* raw = mmap(NULL, len + NUMA_HUGE_PAGE, PROT_READ | PROT_WRITE,
+				flags, -1, 0);
+		if (raw == MAP_FAILED)
+			return NULL;
+		region = (char*) (((uintptr_t) raw + NUMA_HUGE_PAGE - 1)
+				& ~(uintptr_t) (NUMA_HUGE_PAGE - 1));
+		if (region > raw)
+			munmap(raw, region - raw);
+		munmap(region + len, raw + NUMA_HUGE_PAGE - region);
+		madvise(region, len, MADV_HUGEPAGE);
+		return region;
+	}
+	region = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	return region == MAP_FAILED ? NULL : region;
+}
+
+static void region_unmap(numa_t* numa, void* region, size_t bytes) {
+	munmap(region, region_size(numa, bytes));
+}
+
+/*
+ * Auxiliary function:
+ * the machine's nodes and their cpus, false without NUMA in sysfs
+ */
+static bool topology_read(numa_t* numa) {
+	int nodes = read_list("/sys/devices/system/node/online", numa->ids,
+			NUMA_MAX_NODES);
+	if (nodes < 1)
+		return false;
+	numa->nodes = nodes;
+	for (int node = 0; node < nodes; ++node) {
+		char path[64];
+		int cpus[CPU_SETSIZE];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+				numa->ids[node]);
+		int n = read_list(path, cpus, CPU_SETSIZE);
+		CPU_ZERO(&numa->cpus[node]);
+		for (int i = 0; i < n; ++i) {
+			CPU_SET(cpus[i], &numa->cpus[node]);
+		}
+	}
+	return true;
+}
+
+/*
+ * Auxiliary function:
+ * nodes made up by splitting the cpus the process may run on (see
+ * numactl --physcpubind) into contiguous groups
+ */
+static void topology_simulate(numa_t* numa, int nodes) {
+	cpu_set_t allowed;
+	int cpus[CPU_SETSIZE];
+	int n = 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed))
+				cpus[n++] = cpu;
+		}
+	}
+	numa->nodes = nodes;
+	for (int node = 0; node < nodes; ++node) {
+		numa->ids[node] = node;
+		CPU_ZERO(&numa->cpus[node]);
+		for (int i = node * n / nodes; i < (node + 1) * n / nodes; ++i) {
+			CPU_SET(cpus[i], &numa->cpus[node]);
+		}
+	}
+}
+
+//-----------------------------------------------------//
+//Implementations:
+
+numa_t* numa_alloc(int nodes, size_t count, size_t block_size, bool huge) {
+	if (nodes < 0 || nodes > NUMA_MAX_NODES || count < 1 || block_size < 1)
+		return NULL;
+	//the arenas are cache line aligned
+	size_t size = sizeof(numa_t)
+			+ sizeof(numa_arena_t) * NUMA_MAX_NODES * NUMA_SHARDS;
+	numa_t* numa = aligned_alloc(64, (size + 63) & ~(size_t) 63);
+	if (!numa)
+		return NULL;
+	memset(numa, 0, size);
+
+	numa_t machine;
+	bool numa_kernel = topology_read(&machine);
+	if (numa_kernel && (nodes == 0 || nodes == machine.nodes)) {
+		numa->nodes = machine.nodes;
+		memcpy(numa->ids, machine.ids, sizeof(numa->ids));
+		memcpy(numa->cpus, machine.cpus, sizeof(numa->cpus));
+		numa->bound = machine.nodes > 1;
+	} else {
+		topology_simulate(numa, nodes ? nodes : 1);
+	}
+
+	numa->huge = huge;
+	numa->count = count;
+	//with huge pages a slice of the smallest elements, 4 bytes, is 2MB pages
+	size_t align = huge ? NUMA_HUGE_PAGE / 4 : NUMA_SPAN_ALIGN;
+	numa->span = (count + numa->nodes - 1) / numa->nodes;
+	numa->span = (numa->span + align - 1) / align * align;
+	numa->block_size = (block_size + 15) & ~(size_t) 15;
+	numa->chunk_size = NUMA_CHUNK;
+	if (numa->chunk_size < NUMA_CHUNK_HEADER + numa->block_size)
+		numa->chunk_size = page_round(NUMA_CHUNK_HEADER + numa->block_size);
+	for (int i = 0; i < numa->nodes * NUMA_SHARDS; ++i) {
+		lock_init(&numa->arenas[i].lock);
+	}
+	return numa;
+}
+
+void numa_free(numa_t* numa) {
+	if (!numa)
+		return;
+	for (int i = 0; i < numa->nodes * NUMA_SHARDS; ++i) {
+		void* chunk = numa->arenas[i].chunks;
+		while (chunk) {
+			void* next = *(void**) chunk;
+			region_unmap(numa, chunk, numa->chunk_size);
+			chunk = next;
+		}
+	}
+	free(numa);
+}
+
+int numa_nodes(numa_t* numa) {
+	return numa->nodes;
+}
+
+int numa_home(numa_t* numa, size_t bucket) {
+	size_t node = bucket / numa->span;
+	return node < (size_t) numa->nodes ? (int) node : numa->nodes - 1;
+}
+
+void* numa_spread(numa_t* numa, size_t size) {
+	size_t len = region_size(numa, numa->count * size);
+	char* array = region_map(numa, len);
+	if (!array)
+		return NULL;
+	//span is a multiple of the page size, so is every slice
+	size_t slice = numa->span * size;
+	for (int node = 0; node < numa->nodes && node * slice < len; ++node) {
+		size_t start = node * slice;
+		bind_node(numa, array + start, len - start < slice ? len - start : slice,
+				node);
+	}
+	return array;
+}
+
+void numa_unspread(numa_t* numa, void* array, size_t size) {
+	if (array)
+		region_unmap(numa, array, numa->count * size);
+}
+
+void* numa_block_alloc(numa_t* numa, int node, uint8_t* arena) {
+	//a thread keeps its shard, so its allocations rarely meet another's
+	static unsigned int next_shard;
+	static __thread int shard = -1;
+	if (shard < 0)
+		shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED)
+				% NUMA_SHARDS;
+
+	int index = node * NUMA_SHARDS + shard;
+	numa_arena_t* pool = &numa->arenas[index];
+	lock_acquire(&pool->lock);
+	void* block = pool->free_list;
+	if (block) {
+		pool->free_list = *(void**) block;
+	} else {
+		if (pool->unused + numa->block_size > pool->end) {
+			char* chunk = region_map(numa, numa->chunk_size);
+			if (!chunk) {
+				lock_release(&pool->lock);
+				return NULL;
+			}
+			bind_node(numa, chunk, numa->chunk_size, node);
+			*(void**) chunk = pool->chunks;
+			pool->chunks = chunk;
+			pool->unused = chunk + NUMA_CHUNK_HEADER;
+			pool->end = chunk + numa->chunk_size;
+		}
+		block = pool->unused;
+		pool->unused += numa->block_size;
+	}
+	lock_release(&pool->lock);
+	*arena = index + 1;
+	return block;
+}
+
+void numa_block_free(numa_t* numa, void* block, uint8_t arena) {
+	numa_arena_t* pool = &numa->arenas[arena - 1];
+	lock_acquire(&pool->lock);
+	*(void**) block = pool->free_list;
+	pool->free_list = block;
+	lock_release(&pool->lock);
+}
+
+int numa_attr_pin(numa_t* numa, int node, pthread_attr_t* attr) {
+	if (node < 0 || node >= numa->nodes || !CPU_COUNT(&numa->cpus[node]))
+		return -1;
+	return pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t),
+			&numa->cpus[node]) == 0 ? 0 : -1;
+}
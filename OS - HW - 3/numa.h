@@ -0,0 +1,57 @@
+/*
+ * numa.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Placement of the HASH_NUMA tables, without libnuma: the topology is read
+ * from sysfs, memory is bound with mbind and threads are pinned with their
+ * affinity. The buckets are split in one contiguous range per node, the
+ * range being the home of their slice of the bucket arrays, of the nodes
+ * allocated for them and of the threads that work on them.
+ * Where the kernel has no NUMA support everything still works, only
+ * without placement. The same arrays and arenas, on one node, back the
+ * tables with HASH_HUGE_PAGES.
+ */
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define NUMA_MAX_NODES 16
+
+struct numa_t;
+typedef struct numa_t numa_t;
+
+/*
+ * Placement of count buckets, whose nodes take block_size bytes, on nodes
+ * NUMA nodes: 0 for those of the machine. Another number simulates that
+ * many nodes by splitting the online cpus, their memory isn't bound.
+ * huge maps all the memory in 2MB pages, reserved ones if there are,
+ * transparent ones otherwise.
+ */
+numa_t* numa_alloc(int nodes, size_t count, size_t block_size, bool huge);
+void numa_free(numa_t* numa);
+int numa_nodes(numa_t* numa);
+/* home node of a bucket */
+int numa_home(numa_t* numa, size_t bucket);
+
+/* zeroed array of an element of size bytes per bucket, each slice on its home node */
+void* numa_spread(numa_t* numa, size_t size);
+void numa_unspread(numa_t* numa, void* array, size_t size);
+
+/*
+ * Block of block_size bytes on the node, from an arena of the calling
+ * thread; *arena is set to what numa_block_free needs to give it back.
+ */
+void* numa_block_alloc(numa_t* numa, int node, uint8_t* arena);
+void numa_block_free(numa_t* numa, void* block, uint8_t arena);
+
+/* sets the affinity of attr to the cpus of the node, returns -1 if it has none */
+int numa_attr_pin(numa_t* numa, int node, pthread_attr_t* attr);
+
+#endif /* NUMA_H_ */
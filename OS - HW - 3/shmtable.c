@@ -0,0 +1,367 @@
+/*
+ * shmtable.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmtable.h"
+
+#define SHM_MAGIC 0x48534d31 //"HSM1"
+#define SHM_ATTACH_TRIES 1000 //1ms apart, while the creator sets the object up
+
+typedef struct shm_node_t {
+	pthread_mutex_t lock;
+	int key;
+	uint32_t next; //index of the next node, 0 at the tail
+	_Alignas(8) unsigned char data[];
+} shm_node_t;
+
+typedef struct shm_bucket_t {
+	pthread_mutex_t lock; //sentinel in front of the first node
+	uint32_t head;
+	int size;
+} shm_bucket_t;
+
+/*
+ * Start of the shared object, followed by the buckets and the node arena
+ */
+typedef struct shm_header_t {
+	uint32_t magic; //set last by the creator
+	int nr_buckets, value_size, capacity;
+	uint64_t seed;
+	pthread_mutex_t alloc_lock;
+	uint32_t free_list; //removed nodes, linked by next
+	uint32_t unused; //first node that was never handed out
+} shm_header_t;
+
+/*
+ * What one process knows about its mapping
+ */
+struct shmtable_t {
+	shm_header_t* header;
+	shm_bucket_t* buckets;
+	unsigned char* nodes; //node i (from 1) is at nodes + (i - 1) * node_size
+	size_t node_size, size;
+	int (*hash)(int, int);
+};
+
+//-----------------------------------------------------//
+//Auxiliary functions:
+
+static size_t align_up(size_t size, size_t alignment) {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Auxiliary function:
+ * initialize a robust mutex that any process mapping the object can take
+ */
+static void shm_mutex_init(pthread_mutex_t* mutex) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+/*
+ * Auxiliary function:
+ * takes over the lock of a process that died holding it.
+ * the op that process was running is lost, at most one link is stale.
+ */
+static void shm_lock(pthread_mutex_t* mutex) {
+	if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+		pthread_mutex_consistent(mutex);
+}
+
+static inline shm_node_t* node_at(shmtable_t* shm, uint32_t index) {
+	return (shm_node_t*) (shm->nodes + (size_t) (index - 1) * shm->node_size);
+}
+
+static inline uint32_t mix(uint64_t seed, int key) {
+	uint64_t x = (uint32_t) key ^ seed;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (uint32_t) ((x ^ (x >> 31)) >> 32);
+}
+
+/*
+ * Auxiliary function:
+ * takes a node from the free list or the unused part of the arena,
+ * returns 0 when the arena is full
+ */
+static uint32_t node_alloc(shmtable_t* shm) {
+	shm_header_t* header = shm->header;
+	uint32_t index = 0;
+	bool fresh = false;
+
+	shm_lock(&header->alloc_lock);
+	if (header->free_list) {
+		index = header->free_list;
+		header->free_list = node_at(shm, index)->next;
+	} else if (header->unused <= (uint32_t) header->capacity) {
+		index = header->unused++;
+		fresh = true;
+	}
+	pthread_mutex_unlock(&header->alloc_lock);
+
+	//nodes are only set up the first time they are handed out
+	if (fresh)
+		shm_mutex_init(&node_at(shm, index)->lock);
+	return index;
+}
+
+static void node_free(shmtable_t* shm, uint32_t index) {
+	shm_header_t* header = shm->header;
+	shm_lock(&header->alloc_lock);
+	node_at(shm, index)->next = header->free_list;
+	header->free_list = index;
+	pthread_mutex_unlock(&header->alloc_lock);
+}
+
+/*
+ * Auxiliary function:
+ * list_find of hashtable.c over indexes: walks the bucket hand-over-hand,
+ * on return *held guards *link and the node with the key is returned
+ * locked, or NULL with *link the tail link.
+ */
+static shm_node_t* shm_find(shmtable_t* shm, shm_bucket_t* bucket, int key,
+		uint32_t** link, pthread_mutex_t** held) {
+	pthread_mutex_t* prev_lock = &bucket->lock;
+	uint32_t* prev_link = &bucket->head;
+
+	shm_lock(prev_lock);
+	uint32_t index = *prev_link;
+	while (index) {
+		shm_node_t* curr = node_at(shm, index);
+		shm_lock(&curr->lock);
+		if (curr->key == key) {
+			*link = prev_link;
+			*held = prev_lock;
+			return curr;
+		}
+		pthread_mutex_unlock(prev_lock);
+		prev_lock = &curr->lock;
+		prev_link = &curr->next;
+		index = curr->next;
+	}
+	*link = prev_link;
+	*held = prev_lock;
+	return NULL;
+}
+
+/*
+ * Auxiliary function:
+ * creates the object or waits until it exists, returns its size or -1
+ */
+static long shm_open_sized(const char* name, size_t size, int* fd,
+		bool* creator) {
+	*creator = true;
+	*fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (*fd < 0 && errno == EEXIST) {
+		*creator = false;
+		*fd = shm_open(name, O_RDWR, 0);
+	}
+	if (*fd < 0)
+		return -1;
+
+	if (*creator) {
+		if (ftruncate(*fd, size) < 0)
+			return -1;
+		return size;
+	}
+	struct stat st;
+	for (int tries = 0; tries < SHM_ATTACH_TRIES; ++tries) {
+		if (fstat(*fd, &st) < 0)
+			return -1;
+		if (st.st_size > 0)
+			return st.st_size;
+		usleep(1000);
+	}
+	return -1;
+}
+
+//-----------------------------------------------------//
+
+shmtable_t* shmtable_attach(const char* name, int buckets,
+		int (*hash)(int, int), uint64_t seed, int value_size, int capacity) {
+	if (!name || buckets < 1 || value_size < 1 || capacity < 1)
+		return NULL;
+
+	size_t node_size = align_up(sizeof(shm_node_t) + value_size, 8);
+	size_t buckets_at = align_up(sizeof(shm_header_t), 64);
+	size_t nodes_at = align_up(buckets_at + sizeof(shm_bucket_t) * buckets, 64);
+	size_t size = nodes_at + node_size * capacity;
+
+	int fd;
+	bool creator;
+	long actual = shm_open_sized(name, size, &fd, &creator);
+	if (actual != (long) size) {
+		//somebody else's object, or one with other parameters
+		if (fd >= 0)
+			close(fd);
+		if (creator && fd >= 0)
+			shm_unlink(name);
+		return NULL;
+	}
+	void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	shmtable_t* shm = malloc(sizeof(*shm));
+	if (base == MAP_FAILED || !shm) {
+		if (base != MAP_FAILED)
+			munmap(base, size);
+		if (creator)
+			shm_unlink(name);
+		free(shm);
+		return NULL;
+	}
+	shm->header = base;
+	shm->buckets = (shm_bucket_t*) ((unsigned char*) base + buckets_at);
+	shm->nodes = (unsigned char*) base + nodes_at;
+	shm->node_size = node_size;
+	shm->size = size;
+	shm->hash = hash;
+
+	shm_header_t* header = shm->header;
+	if (creator) {
+		header->nr_buckets = buckets;
+		header->value_size = value_size;
+		header->capacity = capacity;
+		header->seed = seed;
+		header->free_list = 0;
+		header->unused = 1;
+		shm_mutex_init(&header->alloc_lock);
+		for (int i = 0; i < buckets; ++i) {
+			shm_mutex_init(&shm->buckets[i].lock);
+			shm->buckets[i].head = 0;
+			shm->buckets[i].size = 0;
+		}
+		__atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+		return shm;
+	}
+
+	int tries = 0;
+	while (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+			&& tries++ < SHM_ATTACH_TRIES) {
+		usleep(1000);
+	}
+	if (header->magic != SHM_MAGIC || header->nr_buckets != buckets
+			|| header->value_size != value_size || header->capacity != capacity) {
+		shmtable_detach(shm);
+		return NULL;
+	}
+	return shm;
+}
+
+void shmtable_detach(shmtable_t* shm) {
+	if (!shm)
+		return;
+	munmap(shm->header, shm->size);
+	free(shm);
+}
+
+int shmtable_bucket(shmtable_t* shm, int key) {
+	int buckets = shm->header->nr_buckets;
+	if (!shm->hash)
+		return (int) (((uint64_t) mix(shm->header->seed, key) * (uint32_t) buckets)
+				>> 32);
+	int bucket = shm->hash(buckets, key);
+	if (bucket < 0 || bucket >= buckets)
+		return -1;
+	return bucket;
+}
+
+int shmtable_bucketsize(shmtable_t* shm, int bucket) {
+	if (bucket < 0 || bucket >= shm->header->nr_buckets)
+		return -1;
+	return __atomic_load_n(&shm->buckets[bucket].size, __ATOMIC_RELAXED);
+}
+
+int shmtable_execute(shmtable_t* shm, op_t* op) {
+	int value_size = shm->header->value_size;
+	int index = shmtable_bucket(shm, op->key);
+	if (index < 0)
+		return op->result = -1;
+	shm_bucket_t* bucket = &shm->buckets[index];
+
+	//the new node is set up before any bucket lock is taken
+	uint32_t fresh = 0;
+	if (op->op == INSERT) {
+		if ((fresh = node_alloc(shm)) == 0)
+			return op->result = -1;
+		shm_node_t* node = node_at(shm, fresh);
+		node->key = op->key;
+		node->next = 0;
+		if (op->val)
+			memcpy(node->data, op->val, value_size);
+		else
+			memset(node->data, 0, value_size);
+	}
+
+	uint32_t* link;
+	pthread_mutex_t* held;
+	shm_node_t* curr = shm_find(shm, bucket, op->key, &link, &held);
+	uint32_t removed = 0;
+	//only inserts and removes change the links
+	bool relink = op->op == INSERT || op->op == REMOVE;
+	if (!relink)
+		pthread_mutex_unlock(held);
+	op->result = curr ? 1 : 0;
+	switch (op->op) {
+	case INSERT:
+		if (!curr) {
+			*link = fresh;
+			fresh = 0;
+			__atomic_add_fetch(&bucket->size, 1, __ATOMIC_RELAXED);
+		}
+		op->result = !curr;
+		break;
+	case REMOVE:
+		if (curr) {
+			removed = *link;
+			*link = curr->next;
+			__atomic_sub_fetch(&bucket->size, 1, __ATOMIC_RELAXED);
+		}
+		break;
+	case CONTAINS:
+		break;
+	case UPDATE:
+		if (curr && op->val)
+			memcpy(curr->data, op->val, value_size);
+		else if (curr)
+			memset(curr->data, 0, value_size); //like an insert of NULL
+		break;
+	case COMPUTE:
+		if (curr)
+			op->val = op->compute_func(curr->data);
+		break;
+	case GET:
+		if (curr)
+			memcpy(op->val, curr->data, value_size);
+		break;
+	default:
+		op->result = -1;
+	}
+	if (relink)
+		pthread_mutex_unlock(held);
+	if (curr)
+		pthread_mutex_unlock(&curr->lock);
+
+	if (removed)
+		node_free(shm, removed);
+	if (fresh)
+		node_free(shm, fresh);
+	return op->result;
+}
@@ -0,0 +1,36 @@
+/*
+ * shmtable.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Storage engine of the tables made by hash_alloc_shm: the bucket
+ * directory and a fixed arena of nodes live in one POSIX shared memory
+ * object that any number of processes map. Links are node indexes
+ * instead of pointers, so every process can map the object anywhere, and
+ * all the locks are robust and process shared.
+ */
+
+#ifndef SHMTABLE_H_
+#define SHMTABLE_H_
+
+#include <stdint.h>
+
+#include "hashtable.h"
+
+struct shmtable_t;
+typedef struct shmtable_t shmtable_t;
+
+/*
+ * Creates the shared object, or attaches to it if another process did.
+ * An existing object must have the same buckets, value_size and capacity.
+ */
+shmtable_t* shmtable_attach(const char* name, int buckets,
+		int (*hash)(int, int), uint64_t seed, int value_size, int capacity);
+void shmtable_detach(shmtable_t* shm);
+/* executes one op with the hash_* semantics, returns op->result */
+int shmtable_execute(shmtable_t* shm, op_t* op);
+int shmtable_bucket(shmtable_t* shm, int key);
+int shmtable_bucketsize(shmtable_t* shm, int bucket);
+
+#endif /* SHMTABLE_H_ */
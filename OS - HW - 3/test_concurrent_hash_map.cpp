@@ -0,0 +1,106 @@
+/*
+ * test_concurrent_hash_map.cpp
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ */
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_utilities.h"
+#include "concurrent_hash_map.hpp"
+
+//test_utilities.h keeps the name in a char*, string literals are const in C++
+#undef SetTestName
+#define SetTestName(str) do { strTestName = const_cast<char*>(str); } while (0)
+
+#define BUCKETS 10
+#define NUM_THREADS 8
+#define NUM_KEYS 1000
+
+using hashtable::ConcurrentHashMap;
+
+struct Record {
+	long long id;
+	char name[24];
+};
+
+int TestMap_IntKeys() {
+	ConcurrentHashMap<long long, Record> map(BUCKETS);
+	ASSERT_EQ(map.bucket_count(), 16);
+
+	long long big = 1LL << 40;
+	ASSERT_EQ(map.insert(big, Record { 1, "one" }), true);
+	ASSERT_EQ(map.insert(big, Record { 2, "two" }), false);
+	ASSERT_EQ(map.emplace(big + 1, Record { 3, "three" }), true);
+	ASSERT_EQ(map.contains(big), true);
+	ASSERT_EQ(map.contains(big + 2), false);
+
+	Record r;
+	ASSERT_EQ(map.get(big, r), true);
+	ASSERT_EQ(r.id, 1);
+	ASSERT_EQ(map.update(big, Record { 4, "four" }), true);
+	ASSERT_EQ(map.compute(big, [](Record& v) { v.id *= 3; }), true);
+	ASSERT_EQ(map.get(big, r), true);
+	ASSERT_EQ(r.id, 12);
+	ASSERT_EQ(map.remove(big), true);
+	ASSERT_EQ(map.remove(big), false);
+	ASSERT_EQ(map.get(big, r), false);
+	ASSERT_EQ(map.bucket_size(16), -1);
+	return true;
+}
+
+int TestMap_StringKeysMoveOnlyValues() {
+	ConcurrentHashMap<std::string, std::unique_ptr<int>,
+			hashtable::DefaultHash<std::string>, hashtable::SpinLockPolicy> map(4);
+
+	ASSERT_EQ(map.emplace("alpha", std::unique_ptr<int>(new int(1))), true);
+	ASSERT_EQ(map.insert("beta", std::unique_ptr<int>(new int(2))), true);
+	ASSERT_EQ(map.emplace("alpha", std::unique_ptr<int>(new int(5))), false);
+	ASSERT_EQ(map.contains("alph"), false);
+	ASSERT_EQ(map.update("beta", std::unique_ptr<int>(new int(20))), true);
+	int seen = 0;
+	ASSERT_EQ(map.compute("beta", [&seen](std::unique_ptr<int>& v) { seen = *v; }), true);
+	ASSERT_EQ(seen, 20);
+	ASSERT_EQ(map.remove("alpha"), true);
+	ASSERT_EQ(map.contains("alpha"), false);
+	return true;
+}
+
+int TestMap_Concurrent() {
+	ConcurrentHashMap<int, int> map(BUCKETS);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < NUM_THREADS; t++) {
+		threads.emplace_back([&map, t]() {
+			for (int i = t; i < NUM_KEYS; i += NUM_THREADS) {
+				map.insert(i, i);
+				map.compute(i, [](int& v) { v *= 2; });
+				if (i % 2)
+					map.remove(i);
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	int sum = 0;
+	for (std::size_t b = 0; b < map.bucket_count(); b++) {
+		sum += map.bucket_size(b);
+	}
+	ASSERT_EQ(sum, NUM_KEYS / 2);
+	int v;
+	ASSERT_EQ(map.get(10, v), true);
+	ASSERT_EQ(v, 20);
+	ASSERT_EQ(map.contains(11), false);
+	return true;
+}
+
+int main() {
+	RUN_TEST(TestMap_IntKeys);
+	RUN_TEST(TestMap_StringKeysMoveOnlyValues);
+	RUN_TEST(TestMap_Concurrent);
+	return 0;
+}
@@ -7,14 +7,18 @@
 
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "test_utilities.h"
 #include "hashtable.h"
+#include "lock.h"
 
 
 #define BUCKETS 10 //basic functionality test adds to hash according to this. changing will ruin outcome.
@@ -661,6 +665,1792 @@ bool TestHashSync(){
 }
 
 
+int TestHashActions_FlatCombining() {
+	hash_opts_t opts = { .flags = HASH_FLAT_COMBINING };
+	ASSERT_NULL(hash_alloc_opts(0, hash_f, &opts));
+	hashtable_t *h = hash_alloc_opts(2, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+
+	int vals[NUM_CMDS];
+	op_t ops[NUM_CMDS];
+	//every op lands on one of two buckets
+	for (int i = 0; i < NUM_CMDS; i++) {
+		vals[i] = i;
+		ops[i].key = i;
+		ops[i].val = &vals[i];
+		ops[i].op = INSERT;
+		ops[i].compute_func = NULL;
+		ops[i].result = 0;
+	}
+	hash_batch(h, NUM_CMDS, ops);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+	}
+	ASSERT_EQ(hash_getbucketsize(h, 0), NUM_CMDS / 2);
+	ASSERT_EQ(hash_getbucketsize(h, 1), NUM_CMDS / 2);
+
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ops[i].op = (i % 2) ? REMOVE : COMPUTE;
+		ops[i].compute_func = compute_f;
+	}
+	hash_batch(h, NUM_CMDS, ops);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+		if (!(i % 2)) {
+			ASSERT_EQ(*(int*)ops[i].val, i);
+		}
+	}
+	ASSERT_EQ(hash_getbucketsize(h, 0), NUM_CMDS / 2);
+	ASSERT_EQ(hash_getbucketsize(h, 1), 0);
+	ASSERT_EQ(hash_contains(h, 1), 0);
+	ASSERT_EQ(hash_contains(h, 2), 1);
+
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+typedef struct transfer_args_t {
+	hashtable h;
+	int from;
+	int to;
+	int *val;
+} transfer_args_t;
+
+/* moves a value back and forth between two keys */
+void* thread_transfer(void *args) {
+	transfer_args_t* t = args;
+	for (int i = 0; i < NUM_CMDS; i++) {
+		op_t txn[2] = {
+			{ .key = (i % 2) ? t->to : t->from, .op = REMOVE },
+			{ .key = (i % 2) ? t->from : t->to, .val = t->val, .op = INSERT },
+		};
+		hash_transaction(t->h, 2, txn);
+	}
+	return NULL;
+}
+
+#define TXN_VALUE (32 * 1024 * 1024)
+
+/*
+ * Auxiliary function:
+ * total and data+stack size of this process in bytes, from /proc/self/statm
+ */
+int statm_read(long* size, long* data) {
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (!statm)
+		return -1;
+	long fields[6];
+	int n = fscanf(statm, "%ld %ld %ld %ld %ld %ld", &fields[0], &fields[1],
+			&fields[2], &fields[3], &fields[4], &fields[5]);
+	fclose(statm);
+	*size = fields[0] * sysconf(_SC_PAGESIZE);
+	*data = fields[5] * sysconf(_SC_PAGESIZE);
+	return n == 6 ? 0 : -1;
+}
+
+/*
+ * the other process of TestHashActions_Transaction: runs out of memory on
+ * the insert of a remove and insert transaction, returns 0 if the removed
+ * key is still there. A value bigger than the heap can't come from its
+ * free space.
+ */
+int transaction_oom_child() {
+	long size, data;
+	if (statm_read(&size, &data) < 0)
+		return 1;
+	hash_opts_t opts = { .flags = HASH_TRANSACTIONS,
+			.value_size = data + TXN_VALUE };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	if (!h || hash_insert(h, 1, NULL) != 1 || statm_read(&size, &data) < 0)
+		return 1;
+	struct rlimit rl = { size + 1024 * 1024, size + 1024 * 1024 };
+	if (setrlimit(RLIMIT_AS, &rl) != 0)
+		return 1;
+	op_t ops[2] = {
+		{ .key = 1, .op = REMOVE },
+		{ .key = 2, .op = INSERT },
+	};
+	if (hash_transaction(h, 2, ops) != -1 || ops[0].result != -1
+			|| ops[1].result != -1)
+		return 1;
+	return hash_contains(h, 1) != 1;
+}
+
+//outlives the ttl of the entries of TestHashActions_Transaction
+void* compute_sleep(void* val) {
+	usleep(40000);
+	return val;
+}
+
+int TestHashActions_Transaction() {
+	hash_opts_t opts = { .flags = HASH_TRANSACTIONS };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+
+	int val1 = 1;
+	int val2 = 2;
+	ASSERT_EQ(hash_insert(h, 1, &val1), 1);
+	ASSERT_EQ(hash_insert(h, 12, &val2), 1);
+
+	//move key 1 to key 22
+	op_t move[2] = {
+		{ .key = 1, .op = REMOVE },
+		{ .key = 22, .val = &val1, .op = INSERT },
+	};
+	ASSERT_EQ(hash_transaction(h, 2, move), 1);
+	ASSERT_EQ(move[0].result, 1);
+	ASSERT_EQ(move[1].result, 1);
+	ASSERT_EQ(hash_contains(h, 1), 0);
+	ASSERT_EQ(hash_contains(h, 22), 1);
+	ASSERT_EQ(hash_getbucketsize(h, 2), 2);
+
+	//second insert fails - the first must not be applied
+	op_t group[3] = {
+		{ .key = 3, .val = &val1, .op = INSERT },
+		{ .key = 3, .op = CONTAINS },
+		{ .key = 12, .val = &val1, .op = INSERT },
+	};
+	ASSERT_EQ(hash_transaction(h, 3, group), 0);
+	ASSERT_EQ(group[0].result, -1);
+	ASSERT_EQ(group[2].result, 0);
+	ASSERT_EQ(hash_contains(h, 3), 0);
+
+	//ops of one transaction see each other
+	op_t chain[3] = {
+		{ .key = 3, .val = &val1, .op = INSERT },
+		{ .key = 3, .val = &val2, .op = UPDATE },
+		{ .key = 3, .op = COMPUTE, .compute_func = compute_f },
+	};
+	ASSERT_EQ(hash_transaction(h, 3, chain), 1);
+	ASSERT_EQ(*(int*)chain[2].val, val2);
+
+	ASSERT_EQ(hash_transaction(NULL, 3, chain), -1);
+	ASSERT_EQ(hash_transaction(h, 0, chain), -1);
+
+	//concurrent transfers never lose or duplicate the moved value
+	pthread_t threads[CMDS];
+	transfer_args_t args[CMDS];
+	int vals[CMDS];
+	for (int i = 0; i < CMDS; i++) {
+		vals[i] = i;
+		args[i] = (transfer_args_t) { h, 100 + i, 200 + 2 * i, &vals[i] };
+		ASSERT_EQ(hash_insert(h, args[i].from, &vals[i]), 1);
+		pthread_create(&threads[i], NULL, thread_transfer, &args[i]);
+	}
+	for (int i = 0; i < CMDS; i++) {
+		pthread_join(threads[i], NULL);
+		ASSERT_EQ(hash_contains(h, args[i].from) + hash_contains(h, args[i].to), 1);
+	}
+
+	//a node that can't be allocated aborts the whole transaction
+	//(the sanitizers' allocators die instead of returning NULL)
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+	pid_t child = fork();
+	if (child == 0)
+		_exit(transaction_oom_child());
+	int status;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_EQ(WIFEXITED(status) && WEXITSTATUS(status) == 0, 1);
+#endif
+
+	//an entry the checks found alive is still there when its op runs
+	hash_opts_t ttl = { .flags = HASH_TRANSACTIONS | HASH_TTL };
+	hashtable_t *expiring = hash_alloc_opts(BUCKETS, hash_f, &ttl);
+	ASSERT_NOT_NULL(expiring);
+	ASSERT_EQ(hash_insert(expiring, 1, &val1), 1);
+	ASSERT_EQ(hash_insert_ttl(expiring, 2, &val1, 20), 1);
+	op_t slow[2] = {
+		{ .key = 1, .op = COMPUTE, .compute_func = compute_sleep },
+		{ .key = 2, .val = &val2, .op = UPDATE },
+	};
+	ASSERT_EQ(hash_transaction(expiring, 2, slow), 1);
+	ASSERT_EQ(slow[0].result, 1);
+	ASSERT_EQ(slow[1].result, 1);
+	ASSERT_EQ(hash_contains(expiring, 2), 0);
+	ASSERT_EQ(hash_stop(expiring), 1);
+	ASSERT_EQ(hash_free(expiring), 1);
+
+	hashtable_t *plain = hash_alloc(BUCKETS, hash_f);
+	ASSERT_EQ(hash_transaction(plain, 2, move), -1);
+	ASSERT_EQ(hash_stop(plain), 1);
+	ASSERT_EQ(hash_free(plain), 1);
+
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+#define RESEED_BUCKETS 65536
+
+int TestHashActions_Reseed() {
+	hash_opts_t opts = { .flags = HASH_AUTO_RESEED, .seed = 12345 };
+	//reseeding needs the built-in hash
+	ASSERT_NULL(hash_alloc_opts(BUCKETS, hash_f, &opts));
+	ASSERT_NULL(hash_alloc(BUCKETS, NULL));
+	hashtable_t *h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+
+	//negative keys are fine for the built-in hash
+	int val = 1;
+	ASSERT_EQ(hash_insert(h, -1, &val), 1);
+	ASSERT_EQ(hash_contains(h, -1), 1);
+	ASSERT_EQ(hash_remove(h, -1), 1);
+
+	//flood one bucket with keys that collide under the current seed
+	int keys[NUM_CMDS];
+	int nr_keys = 0;
+	int target = hash_getbucket(h, 0);
+	for (int key = 0; nr_keys < 3 * HASH_DEFAULT_MAX_CHAIN; key++) {
+		if (hash_getbucket(h, key) == target)
+			keys[nr_keys++] = key;
+	}
+	for (int i = 0; i < nr_keys; i++) {
+		ASSERT_EQ(hash_insert(h, keys[i], &val), 1);
+	}
+	ASSERT_GE(hash_getreseeds(h), 1);
+
+	int sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		ASSERT_LE(hash_getbucketsize(h, i), HASH_DEFAULT_MAX_CHAIN);
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, nr_keys);
+	for (int i = 0; i < nr_keys; i++) {
+		ASSERT_EQ(hash_contains(h, keys[i]), 1);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//a big table reseeds on its first flooded bucket too
+	h = hash_alloc_opts(RESEED_BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	target = hash_getbucket(h, 0);
+	nr_keys = 0;
+	for (int key = 0; nr_keys < 3 * HASH_DEFAULT_MAX_CHAIN; key++) {
+		if (hash_getbucket(h, key) == target)
+			keys[nr_keys++] = key;
+	}
+	for (int i = 0; i < nr_keys; i++) {
+		ASSERT_EQ(hash_insert(h, keys[i], &val), 1);
+	}
+	ASSERT_GE(hash_getreseeds(h), 1);
+	for (int i = 0; i < RESEED_BUCKETS; i++) {
+		ASSERT_LE(hash_getbucketsize(h, i), HASH_DEFAULT_MAX_CHAIN);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_PowerOfTwo() {
+	ASSERT_NULL(hash_alloc_fast(0));
+	hash_opts_t opts = { .flags = HASH_POW2_BUCKETS };
+	ASSERT_NULL(hash_alloc_opts(BUCKETS, hash_f, &opts));
+
+	//rounded up to 16 buckets
+	hashtable_t *h = hash_alloc_fast(BUCKETS);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_getbucketsize(h, 15), 0);
+	ASSERT_EQ(hash_getbucketsize(h, 16), -1);
+
+	int vals[MAX_KEY];
+	for (int i = 0; i < MAX_KEY; i++) {
+		vals[i] = i;
+		ASSERT_EQ(hash_insert(h, i - MAX_KEY / 2, &vals[i]), 1);
+		ASSERT_BETWEEN(hash_getbucket(h, i), 0, 15);
+	}
+	int sum = 0;
+	for (int i = 0; i < 16; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, MAX_KEY);
+	void* res;
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(list_node_compute(h, i - MAX_KEY / 2, compute_f, &res), 1);
+		ASSERT_EQ(*(int*)res, i);
+		ASSERT_EQ(hash_remove(h, i - MAX_KEY / 2), 1);
+	}
+
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the smallest masked table has two buckets
+	h = hash_alloc_fast(1);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_getbucketsize(h, 1), 0);
+	ASSERT_EQ(hash_getbucketsize(h, 2), -1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+void hash_many_f(int buckets, const int *keys, int *out, int n) {
+	for (int i = 0; i < n; i++) {
+		out[i] = keys[i] % buckets;
+	}
+}
+
+int TestHashActions_HashMany() {
+	int keys[NUM_CMDS + 3];
+	int out[NUM_CMDS + 3];
+	for (int i = 0; i < NUM_CMDS + 3; i++) {
+		keys[i] = (i % 2) ? -i * 7919 : i * 104729;
+	}
+
+	//the batch hash must agree with the single key one
+	hash_opts_t opts[3] = {
+		{ .seed = 42 },
+		{ .flags = HASH_POW2_BUCKETS },
+		{ .hash_many = hash_many_f },
+	};
+	for (int t = 0; t < 3; t++) {
+		hashtable_t *h = hash_alloc_opts(NUM_BUCKETS, (t == 2) ? hash_f : NULL, &opts[t]);
+		ASSERT_NOT_NULL(h);
+		ASSERT_EQ(hash_getbuckets(h, keys, out, NUM_CMDS + 3), NUM_CMDS + 3);
+		for (int i = 0; i < NUM_CMDS + 3; i++) {
+			ASSERT_EQ(out[i], hash_getbucket(h, keys[i]));
+		}
+		ASSERT_EQ(hash_getbuckets(NULL, keys, out, 1), -1);
+		ASSERT_EQ(hash_stop(h), 1);
+		ASSERT_EQ(hash_free(h), 1);
+	}
+
+	//batches are routed by the batch hash
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts[2]);
+	ASSERT_NOT_NULL(h);
+	op_t ops[MAX_KEY];
+	for (int i = 0; i < MAX_KEY; i++) {
+		ops[i] = (op_t) { .key = i - 1, .val = &keys[0], .op = INSERT };
+	}
+	hash_batch(h, MAX_KEY, ops);
+	ASSERT_EQ(ops[0].result, -1);
+	for (int i = 1; i < MAX_KEY; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+	}
+	ASSERT_EQ(hash_getbucketsize(h, 0), MAX_KEY / BUCKETS);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_Cuckoo() {
+	hash_opts_t opts = { .flags = HASH_CUCKOO };
+	hash_opts_t bad = { .flags = HASH_CUCKOO | HASH_TRANSACTIONS };
+	ASSERT_NULL(hash_alloc_opts(BUCKETS, hash_f, &bad));
+	hashtable_t *h = hash_alloc_opts(2, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+
+	int val1 = 1;
+	int val2 = 2;
+	void* res;
+	ASSERT_EQ(hash_insert(h, 1, &val1), 1);
+	ASSERT_EQ(hash_insert(h, 1, &val2), 0);
+	ASSERT_EQ(hash_insert(h, -1, &val2), -1);
+	ASSERT_EQ(hash_contains(h, 1), 1);
+	ASSERT_EQ(hash_contains(h, 3), 0);
+	ASSERT_EQ(hash_update(h, 1, &val2), 1);
+	ASSERT_EQ(hash_update(h, 3, &val2), 0);
+	ASSERT_EQ(list_node_compute(h, 1, compute_f, &res), 1);
+	ASSERT_EQ(*(int*)res, val2);
+	ASSERT_EQ(list_node_compute(h, 3, compute_f, &res), 0);
+	ASSERT_EQ(hash_remove(h, 1), 1);
+	ASSERT_EQ(hash_remove(h, 1), 0);
+	ASSERT_EQ(hash_contains(h, 1), 0);
+
+	//two buckets of four slots - inserting more keys grows the table
+	int vals[STRESS_CMDS];
+	op_t ops[STRESS_CMDS];
+	for (int i = 0; i < STRESS_CMDS; i++) {
+		vals[i] = i;
+		ops[i] = (op_t) { .key = i % (STRESS_CMDS / 2), .val = &vals[i],
+			.op = (i < STRESS_CMDS / 2) ? INSERT : CONTAINS };
+	}
+	hash_batch(h, STRESS_CMDS / 2, ops);
+	hash_batch(h, STRESS_CMDS / 2, ops + STRESS_CMDS / 2);
+	for (int i = 0; i < STRESS_CMDS; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+	}
+	int sum = 0;
+	for (int i = 0; hash_getbucketsize(h, i) >= 0; i++) {
+		ASSERT_LE(hash_getbucketsize(h, i), 4);
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, STRESS_CMDS / 2);
+
+	//removes and lookups at the same time
+	for (int i = 0; i < STRESS_CMDS; i++) {
+		ops[i].op = (i % 2) ? REMOVE : COMPUTE;
+		ops[i].key = i / 2;
+		ops[i].compute_func = compute_f;
+	}
+	hash_batch(h, STRESS_CMDS, ops);
+	for (int i = 0; i < STRESS_CMDS; i++) {
+		if (i % 2) {
+			ASSERT_EQ(ops[i].result, 1);
+		} else {
+			ASSERT_BETWEEN(ops[i].result, 0, 1);
+		}
+		ASSERT_EQ(hash_contains(h, i / 2), 0);
+	}
+
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+typedef struct record_t {
+	int id;
+	double score;
+	char name[16];
+} record_t;
+
+void* compute_record(void* val) {
+	((record_t*)val)->score *= 2;
+	return val;
+}
+
+int TestHashActions_InlineValues() {
+	hash_opts_t opts = { .value_size = sizeof(record_t) };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+
+	record_t rec = { 1, 1.5, "first" };
+	record_t out;
+	ASSERT_EQ(hash_insert(h, 1, &rec), 1);
+	ASSERT_EQ(hash_insert(h, 11, NULL), 1);
+	//the table keeps its own copy
+	rec.id = 2;
+	ASSERT_EQ(hash_get(h, 1, &out), 1);
+	ASSERT_EQ(out.id, 1);
+	ASSERT_EQ(strcmp(out.name, "first"), 0);
+	ASSERT_EQ(hash_get(h, 11, &out), 1);
+	ASSERT_EQ(out.id, 0);
+	ASSERT_EQ(hash_get(h, 2, &out), 0);
+	ASSERT_EQ(hash_get(h, 1, NULL), -1);
+
+	ASSERT_EQ(hash_update(h, 1, &rec), 1);
+	void* res;
+	ASSERT_EQ(list_node_compute(h, 1, compute_record, &res), 1);
+	ASSERT_EQ(hash_get(h, 1, &out), 1);
+	ASSERT_EQ(out.id, 2);
+	ASSERT_EQ((int)out.score, 3);
+	//an update with NULL zeroes the value, as an insert with NULL does
+	ASSERT_EQ(hash_update(h, 1, NULL), 1);
+	ASSERT_EQ(hash_get(h, 1, &out), 1);
+	ASSERT_EQ(out.id, 0);
+	ASSERT_EQ(out.name[0], 0);
+	ASSERT_EQ(hash_update(h, 1, &rec), 1);
+
+	//batches copy in as well
+	op_t ops[CMDS];
+	record_t recs[CMDS];
+	for (int i = 0; i < CMDS; i++) {
+		recs[i] = (record_t) { 100 + i, i, "batch" };
+		ops[i] = (op_t) { .key = 20 + i, .val = &recs[i], .op = INSERT };
+	}
+	hash_batch(h, CMDS, ops);
+	for (int i = 0; i < CMDS; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+		ASSERT_EQ(hash_get(h, 20 + i, &out), 1);
+		ASSERT_EQ(out.id, 100 + i);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//without inline values hash_get copies the pointer out
+	h = hash_alloc(BUCKETS, hash_f);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_insert(h, 1, &rec), 1);
+	ASSERT_EQ(hash_get(h, 1, &res), 1);
+	ASSERT_EQ(res == &rec, 1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int evicted_count = 0;
+
+void evict_f(int key, void* val) {
+	(void) key;
+	__atomic_add_fetch(&evicted_count, 1, __ATOMIC_RELAXED);
+	free(val);
+}
+
+int TestHashActions_Eviction() {
+	hash_opts_t opts = { .capacity = NUM_BUCKETS, .evict = evict_f };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	evicted_count = 0;
+
+	//the hot key is looked up all the time and must survive the churn
+	ASSERT_EQ(hash_insert(h, 0, malloc(sizeof(int))), 1);
+	for (int i = 1; i < NUM_CMDS; i++) {
+		ASSERT_EQ(hash_insert(h, i, malloc(sizeof(int))), 1);
+		ASSERT_EQ(hash_contains(h, 0), 1);
+	}
+	int sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, NUM_BUCKETS);
+	ASSERT_EQ(evicted_count, NUM_CMDS - NUM_BUCKETS);
+
+	//concurrent inserts stay bounded too
+	op_t ops[NUM_CMDS];
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ops[i] = (op_t) { .key = NUM_CMDS + i, .val = malloc(sizeof(int)), .op = INSERT };
+	}
+	hash_batch(h, NUM_CMDS, ops);
+	sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, NUM_BUCKETS);
+	ASSERT_EQ(evicted_count, 2 * NUM_CMDS - NUM_BUCKETS);
+
+	//free what is left
+	for (int key = 0; key < 2 * NUM_CMDS; key++) {
+		void* val;
+		if (hash_get(h, key, &val) == 1) {
+			ASSERT_EQ(hash_remove(h, key), 1);
+			free(val);
+		}
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//a byte budget is turned into entries
+	hash_opts_t bytes = { .capacity_bytes = 1, .value_size = sizeof(int) };
+	h = hash_alloc_opts(BUCKETS, hash_f, &bytes);
+	ASSERT_NOT_NULL(h);
+	int val = 1;
+	ASSERT_EQ(hash_insert(h, 1, &val), 1);
+	ASSERT_EQ(hash_insert(h, 2, &val), 1);
+	ASSERT_EQ(hash_contains(h, 1) + hash_contains(h, 2), 1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_Expiry() {
+	hash_opts_t opts = { .flags = HASH_TTL, .sweep_ms = 5, .evict = evict_f };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	evicted_count = 0;
+
+	//expired entries are absent on lookup
+	ASSERT_EQ(hash_insert_ttl(h, 1, malloc(sizeof(int)), 20), 1);
+	ASSERT_EQ(hash_insert(h, 2, malloc(sizeof(int))), 1);
+	int* renewed = malloc(sizeof(int));
+	ASSERT_EQ(hash_insert_ttl(h, 3, renewed, 20), 1);
+	ASSERT_EQ(hash_contains(h, 1), 1);
+	ASSERT_EQ(hash_update_ttl(h, 3, renewed, 60000), 1);
+	usleep(50000);
+	ASSERT_EQ(hash_contains(h, 1), 0);
+	ASSERT_EQ(hash_contains(h, 2), 1);
+	ASSERT_EQ(hash_contains(h, 3), 1);
+	ASSERT_EQ(hash_insert_ttl(h, 1, malloc(sizeof(int)), 60000), 1);
+	ASSERT_EQ(hash_insert_ttl(h, 1, NULL, 60000), 0);
+	ASSERT_EQ(hash_insert_ttl(h, 4, NULL, 0), -1);
+
+	//the sweeper frees what nobody looks up again
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ASSERT_EQ(hash_insert_ttl(h, 10 + i, malloc(sizeof(int)), 10), 1);
+	}
+	int expired = 0;
+	for (int tries = 0; tries < 100 && expired < NUM_CMDS + 1; tries++) {
+		usleep(10000);
+		expired = __atomic_load_n(&evicted_count, __ATOMIC_RELAXED);
+	}
+	ASSERT_EQ(expired, NUM_CMDS + 1);
+	int sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, 3);
+
+	for (int key = 1; key <= 3; key++) {
+		void* val;
+		ASSERT_EQ(hash_get(h, key, &val), 1);
+		ASSERT_EQ(hash_remove(h, key), 1);
+		free(val);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//only HASH_TTL tables take a ttl
+	h = hash_alloc(BUCKETS, hash_f);
+	ASSERT_EQ(hash_insert_ttl(h, 1, NULL, 10), -1);
+	ASSERT_EQ(hash_contains(h, 1), 0);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+#define SWEPT_BUCKETS (1 << 16)
+
+int TestHashActions_SweepLargeTable() {
+	hash_opts_t opts = { .flags = HASH_TTL, .sweep_ms = 20, .evict = evict_f };
+	hashtable_t *h = hash_alloc_opts(SWEPT_BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	evicted_count = 0;
+
+	//one entry per bucket, the sweeper still goes over all of them in a few steps
+	for (int key = 0; key < SWEPT_BUCKETS; key++) {
+		ASSERT_EQ(hash_insert_ttl(h, key, malloc(sizeof(int)), 1), 1);
+	}
+	int expired = 0;
+	for (int tries = 0; tries < 300 && expired < SWEPT_BUCKETS; tries++) {
+		usleep(10000);
+		expired = __atomic_load_n(&evicted_count, __ATOMIC_RELAXED);
+	}
+	ASSERT_EQ(expired, SWEPT_BUCKETS);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int seen[MAX_KEY];
+
+void count_f(int key, void* val) {
+	(void) val;
+	__atomic_add_fetch(&seen[key], 1, __ATOMIC_RELAXED);
+}
+
+void* thread_churn(void *args) {
+	hashtable_t* h = args;
+	//keys above MAX_KEY / 2 come and go while the table is walked
+	for (int i = 0; i < NUM_CMDS; i++) {
+		int key = MAX_KEY / 2 + i % (MAX_KEY / 2);
+		if (hash_insert(h, key, NULL) != 1)
+			hash_remove(h, key);
+	}
+	return NULL;
+}
+
+int TestHashActions_Iterator() {
+	hashtable_t *h = hash_alloc(BUCKETS, hash_f);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < MAX_KEY / 2; i++) {
+		ASSERT_EQ(hash_insert(h, i, &seen[i]), 1);
+	}
+
+	//stable keys are returned exactly once despite the churn
+	pthread_t churn;
+	pthread_create(&churn, NULL, thread_churn, h);
+	memset(seen, 0, sizeof(seen));
+	hash_iter_t* iter = hash_iter_begin(h);
+	ASSERT_NOT_NULL(iter);
+	int key;
+	void* val;
+	while (hash_iter_next(iter, &key, &val) == 1) {
+		ASSERT_BETWEEN(key, 0, MAX_KEY - 1);
+		if (key < MAX_KEY / 2)
+			ASSERT_EQ(val == &seen[key], 1);
+		seen[key]++;
+	}
+	hash_iter_end(iter);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_BETWEEN(seen[i], i < MAX_KEY / 2 ? 1 : 0, 1);
+	}
+
+	memset(seen, 0, sizeof(seen));
+	long visited = hash_parallel_foreach(h, count_f, 4);
+	pthread_join(churn, NULL);
+	ASSERT_GE(visited, MAX_KEY / 2);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_BETWEEN(seen[i], i < MAX_KEY / 2 ? 1 : 0, 1);
+	}
+
+	//without the churn the count is exact
+	memset(seen, 0, sizeof(seen));
+	int present = 0;
+	for (int i = 0; i < MAX_KEY; i++) {
+		present += hash_contains(h, i);
+	}
+	ASSERT_EQ(hash_parallel_foreach(h, count_f, 1), present);
+	ASSERT_EQ(hash_parallel_foreach(h, count_f, 0), -1);
+
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_NULL(hash_iter_begin(h));
+	ASSERT_EQ(hash_free(h), 1);
+
+	//inline values come out as bytes
+	hash_opts_t opts = { .value_size = sizeof(int) };
+	h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		int v = i * 2;
+		ASSERT_EQ(hash_insert(h, i, &v), 1);
+	}
+	iter = hash_iter_begin(h);
+	int count = 0, v;
+	while (hash_iter_next(iter, &key, &v) == 1) {
+		ASSERT_EQ(v, key * 2);
+		count++;
+	}
+	ASSERT_EQ(hash_iter_next(iter, &key, &v), 0);
+	hash_iter_end(iter);
+	ASSERT_EQ(count, NUM_CMDS);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+void* increment_f(void* val) {
+	(*(int*) val)++;
+	return val;
+}
+
+void* halve_f(void* val) {
+	return (void*) ((intptr_t) val / 2);
+}
+
+void* thread_increment(void *args) {
+	hashtable_t* h = args;
+	void* res;
+	for (int i = 0; i < NUM_CMDS; i++) {
+		list_node_compute(h, i % MAX_KEY, increment_f, &res);
+	}
+	return NULL;
+}
+
+int TestHashActions_ComputeAll() {
+	hash_opts_t opts = { .value_size = sizeof(int) };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < MAX_KEY; i++) {
+		int v = i;
+		ASSERT_EQ(hash_insert(h, i, &v), 1);
+	}
+
+	//no increment is lost between the pass and the single key computes
+	pthread_t incrementer;
+	pthread_create(&incrementer, NULL, thread_increment, h);
+	ASSERT_EQ(hash_compute_all(h, increment_f, 4), MAX_KEY);
+	ASSERT_EQ(hash_compute_all(h, increment_f, 2), MAX_KEY);
+	pthread_join(incrementer, NULL);
+	long sum = 0;
+	for (int i = 0; i < MAX_KEY; i++) {
+		int v;
+		ASSERT_EQ(hash_get(h, i, &v), 1);
+		sum += v;
+	}
+	ASSERT_EQ(sum, MAX_KEY * (MAX_KEY - 1) / 2 + 2 * MAX_KEY + NUM_CMDS);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_compute_all(h, increment_f, 1), -1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//void* values are replaced by the result
+	h = hash_alloc(BUCKETS, hash_f);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_insert(h, i, (void*) (intptr_t) (4 * i)), 1);
+	}
+	ASSERT_EQ(hash_compute_all(h, halve_f, 3), MAX_KEY);
+	for (int i = 0; i < MAX_KEY; i++) {
+		void* v;
+		ASSERT_EQ(hash_get(h, i, &v), 1);
+		ASSERT_EQ((intptr_t) v, 2 * i);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//any number of threads asked for on a big table: no more than the cpus
+	h = hash_alloc_opts(1 << 22, NULL, NULL);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_insert(h, i, (void*) (intptr_t) (4 * i)), 1);
+	}
+	ASSERT_EQ(hash_compute_all(h, halve_f, 1 << 30), MAX_KEY);
+	void* v;
+	ASSERT_EQ(hash_get(h, 1, &v), 1);
+	ASSERT_EQ((intptr_t) v, 2);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_Teardown() {
+	//enough nodes for hash_free to split the buckets across threads
+	int entries = 1 << 18;
+	hashtable_t *h = hash_alloc_fast(entries / 4);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < entries; i++) {
+		ASSERT_EQ(hash_insert(h, i, NULL), 1);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//a long chain is freed without recursion
+	h = hash_alloc(1, hash_f);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ASSERT_EQ(hash_insert(h, i, NULL), 1);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_Tombstones() {
+	hash_opts_t opts = { .flags = HASH_TOMBSTONES, .sweep_ms = 1 };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_insert(h, i, &seen[i]), 1);
+	}
+
+	//removed keys are gone right away, before the compactor runs
+	for (int i = 0; i < MAX_KEY; i += 2) {
+		ASSERT_EQ(hash_remove(h, i), 1);
+		ASSERT_EQ(hash_remove(h, i), 0);
+		ASSERT_EQ(hash_contains(h, i), 0);
+	}
+	int sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, MAX_KEY / 2);
+	memset(seen, 0, sizeof(seen));
+	ASSERT_EQ(hash_parallel_foreach(h, count_f, 2), MAX_KEY / 2);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(seen[i], i % 2);
+	}
+	ASSERT_EQ(hash_insert(h, 0, &seen[0]), 1);
+	void* val;
+	ASSERT_EQ(hash_get(h, 0, &val), 1);
+	ASSERT_EQ(val == &seen[0], 1);
+
+	//removes racing inserts and the compactor
+	op_t ops[NUM_CMDS];
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ops[i] = (op_t) { .key = i % MAX_KEY, .val = &seen[0],
+				.op = (i % 3) ? REMOVE : INSERT };
+	}
+	hash_batch(h, NUM_CMDS, ops);
+	usleep(20000);
+	sum = 0;
+	int present = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	for (int i = 0; i < MAX_KEY; i++) {
+		present += hash_contains(h, i);
+	}
+	ASSERT_EQ(sum, present);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//a reseed before the compactor runs drops the tombstones
+	opts = (hash_opts_t) { .flags = HASH_TOMBSTONES | HASH_AUTO_RESEED,
+			.sweep_ms = 60000, .seed = 12345 };
+	h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	usleep(10000);
+	int keys[3 * HASH_DEFAULT_MAX_CHAIN];
+	int nr_keys = 0;
+	int target = hash_getbucket(h, 0);
+	for (int key = 0; nr_keys < 3 * HASH_DEFAULT_MAX_CHAIN; key++) {
+		if (hash_getbucket(h, key) == target)
+			keys[nr_keys++] = key;
+	}
+	for (int i = 0; i < HASH_DEFAULT_MAX_CHAIN; i++) {
+		ASSERT_EQ(hash_insert(h, keys[i], NULL), 1);
+	}
+	for (int i = 0; i < HASH_DEFAULT_MAX_CHAIN / 2; i++) {
+		ASSERT_EQ(hash_remove(h, keys[i]), 1);
+	}
+	for (int i = HASH_DEFAULT_MAX_CHAIN; i < nr_keys; i++) {
+		ASSERT_EQ(hash_insert(h, keys[i], NULL), 1);
+	}
+	ASSERT_GE(hash_getreseeds(h), 1);
+	sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, nr_keys - HASH_DEFAULT_MAX_CHAIN / 2);
+	for (int i = 0; i < nr_keys; i++) {
+		ASSERT_EQ(hash_contains(h, keys[i]), i >= HASH_DEFAULT_MAX_CHAIN / 2);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+/*
+ * the other process of TestHashActions_SharedMemory: fills the upper half
+ * of the keys, returns 0 if all of them went in
+ */
+int shm_child(const char* name, hash_opts_t* opts) {
+	hashtable_t *h = hash_alloc_shm(name, BUCKETS, hash_f, opts);
+	if (!h)
+		return 1;
+	int failed = 0;
+	for (int i = NUM_CMDS; i < 2 * NUM_CMDS; i++) {
+		int v = 3 * i;
+		failed |= hash_insert(h, i, &v) != 1;
+	}
+	hash_stop(h);
+	hash_free(h);
+	return failed;
+}
+
+int TestHashActions_SharedMemory() {
+	char name[MAX_BUFSIZE];
+	sprintf(name, "/hashtable_test_%d", getpid());
+	hash_opts_t opts = { .value_size = sizeof(int), .capacity = 2 * NUM_CMDS };
+	hashtable_t *h = hash_alloc_shm(name, BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+
+	//both processes insert at the same time
+	pid_t child = fork();
+	if (child == 0)
+		_exit(shm_child(name, &opts));
+	for (int i = 0; i < NUM_CMDS; i++) {
+		int v = 3 * i;
+		ASSERT_EQ(hash_insert(h, i, &v), 1);
+	}
+	int status;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_EQ(WIFEXITED(status) && WEXITSTATUS(status) == 0, 1);
+
+	int sum = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		sum += hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, 2 * NUM_CMDS);
+	for (int i = 0; i < 2 * NUM_CMDS; i++) {
+		int v;
+		ASSERT_EQ(hash_get(h, i, &v), 1);
+		ASSERT_EQ(v, 3 * i);
+	}
+	int v;
+	ASSERT_EQ(hash_update(h, 1, NULL), 1);
+	ASSERT_EQ(hash_get(h, 1, &v), 1);
+	ASSERT_EQ(v, 0);
+
+	//the arena is full until something is removed
+	v = 0;
+	ASSERT_EQ(hash_insert(h, 2 * NUM_CMDS, &v), -1);
+	ASSERT_EQ(hash_remove(h, 0), 1);
+	ASSERT_EQ(hash_insert(h, 2 * NUM_CMDS, &v), 1);
+	ASSERT_EQ(hash_contains(h, 0), 0);
+
+	//attaching needs the same shape
+	hash_opts_t other = { .value_size = sizeof(long), .capacity = 2 * NUM_CMDS };
+	ASSERT_NULL(hash_alloc_shm(name, BUCKETS, hash_f, &other));
+	ASSERT_NULL(hash_alloc_shm(name, BUCKETS, hash_f, NULL));
+
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	ASSERT_EQ(hash_unlink_shm(name), 1);
+	ASSERT_EQ(hash_unlink_shm(name), 0);
+	return true;
+}
+
+
+typedef struct feed_args_t {
+	hashtable_t* h;
+	int first; //keys first .. first + CMDS - 1
+	int* running;
+} feed_args_t;
+
+void* thread_feed_writer(void *args) {
+	feed_args_t* f = args;
+	for (int i = 0; i < NUM_CMDS; i++) {
+		int key = f->first + i % CMDS;
+		if (hash_insert(f->h, key, NULL) != 1)
+			hash_remove(f->h, key);
+	}
+	__atomic_sub_fetch(f->running, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int TestHashActions_ChangeFeed() {
+	//big enough that no writer thread overflows its ring
+	hash_opts_t opts = { .flags = HASH_CHANGE_FEED, .feed_size = NUM_CMDS };
+	hashtable_t *h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	hash_change_t changes[NUM_CMDS];
+	unsigned long long dropped = 0;
+
+	//changes come out in the order they were made, failed ops leave nothing
+	int val = 0;
+	void* res;
+	ASSERT_EQ(hash_insert(h, 1, &val), 1);
+	ASSERT_EQ(hash_insert(h, 1, &val), 0);
+	ASSERT_EQ(hash_insert(h, 2, NULL), 1);
+	ASSERT_EQ(hash_update(h, 2, &val), 1);
+	ASSERT_EQ(list_node_compute(h, 1, increment_f, &res), 1);
+	ASSERT_EQ(hash_remove(h, 1), 1);
+	ASSERT_EQ(hash_remove(h, 1), 0);
+	ASSERT_EQ(hash_feed_read(h, changes, NUM_CMDS, &dropped), 4 + 1);
+	ASSERT_EQ(dropped, 0);
+	int ops[] = { INSERT, INSERT, UPDATE, COMPUTE, REMOVE };
+	int keys[] = { 1, 2, 2, 1, 1 };
+	for (int i = 0; i < 5; i++) {
+		ASSERT_EQ(changes[i].seq, i + 1);
+		ASSERT_EQ(changes[i].op, ops[i]);
+		ASSERT_EQ(changes[i].key, keys[i]);
+	}
+	ASSERT_EQ(changes[2].val == &val, 1);
+	ASSERT_EQ(hash_feed_read(h, changes, NUM_CMDS, &dropped), 0);
+
+	//concurrent writers: one global order, per key inserts and removes alternate
+	pthread_t writers[CMDS];
+	feed_args_t args[CMDS];
+	int running = CMDS;
+	for (int i = 0; i < CMDS; i++) {
+		args[i] = (feed_args_t) { h, 100 + CMDS * i, &running };
+		pthread_create(&writers[i], NULL, thread_feed_writer, &args[i]);
+	}
+	int present[100 + CMDS * CMDS] = { 0 };
+	unsigned long long last = 5;
+	long total = 0;
+	int done = 0, n = 1;
+	while (!done || n > 0) {
+		done = __atomic_load_n(&running, __ATOMIC_ACQUIRE) == 0;
+		n = hash_feed_read(h, changes, NUM_CMDS, &dropped);
+		ASSERT_GE(n, 0);
+		for (int i = 0; i < n; i++) {
+			ASSERT_GT(changes[i].seq, last);
+			last = changes[i].seq;
+			int key = changes[i].key;
+			ASSERT_EQ(present[key], changes[i].op == REMOVE);
+			present[key] = changes[i].op == INSERT;
+		}
+		total += n;
+	}
+	for (int i = 0; i < CMDS; i++) {
+		pthread_join(writers[i], NULL);
+	}
+	ASSERT_EQ(dropped, 0);
+	ASSERT_EQ(total, CMDS * NUM_CMDS);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//a reader that falls behind is told how much it lost
+	hash_opts_t small = { .flags = HASH_CHANGE_FEED, .feed_size = 4 };
+	h = hash_alloc_opts(BUCKETS, hash_f, &small);
+	for (int i = 0; i < 20; i++) {
+		ASSERT_EQ(hash_insert(h, i, NULL), 1);
+	}
+	dropped = 0;
+	ASSERT_EQ(hash_feed_read(h, changes, NUM_CMDS, &dropped), 4);
+	ASSERT_EQ(dropped, 16);
+	ASSERT_EQ(changes[3].key, 3);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	ASSERT_EQ(hash_feed_read(NULL, changes, 1, &dropped), -1);
+	return true;
+}
+
+
+typedef struct ckpt_args_t {
+	hashtable_t* h;
+	int* running;
+} ckpt_args_t;
+
+void* thread_ckpt_writer(void *args) {
+	ckpt_args_t* c = args;
+	unsigned int seed = 1;
+	for (int i = 0; i < STRESS_CMDS; i++) {
+		int key = rand_r(&seed) % MAX_KEY, val = i;
+		if (i % 3 == 0)
+			hash_remove(c->h, key);
+		else if (hash_insert(c->h, key, &val) == 0)
+			hash_update(c->h, key, &val);
+	}
+	__atomic_store_n(c->running, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * restores the checkpoints of fd into a new table and compares it to h
+ */
+int checkpoint_matches(hashtable_t* h, int fd) {
+	hash_opts_t opts = { .flags = HASH_CHECKPOINT, .value_size = sizeof(int) };
+	hashtable_t *copy = hash_alloc_opts(NUM_BUCKETS, hash_f, &opts);
+	lseek(fd, 0, SEEK_SET);
+	int restored = hash_restore(copy, fd);
+	int live = 0;
+	for (int key = 0; key < MAX_KEY; key++) {
+		int a = -1, b = -1;
+		int in_h = hash_get(h, key, &a), in_copy = hash_get(copy, key, &b);
+		if (in_h != in_copy || a != b)
+			live = -1 - MAX_KEY;
+		live += in_h;
+	}
+	hash_stop(copy);
+	hash_free(copy);
+	return live == restored;
+}
+
+int TestHashActions_Checkpoint() {
+	hash_opts_t opts = { .flags = HASH_CHECKPOINT, .value_size = sizeof(int) };
+	hashtable_t *h = hash_alloc_opts(NUM_BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	FILE* log = tmpfile();
+	FILE* base = tmpfile();
+	ASSERT_NOT_NULL(log);
+	ASSERT_NOT_NULL(base);
+
+	//the first checkpoint is a base image of the non empty buckets
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_insert(h, i, &i), 1);
+	}
+	ASSERT_EQ(hash_checkpoint(h, fileno(log)), NUM_BUCKETS);
+	//nothing changed, nothing written
+	ASSERT_EQ(hash_checkpoint(h, fileno(log)), 0);
+	//only the buckets of the keys changed
+	int val = 500;
+	ASSERT_EQ(hash_update(h, 5, &val), 1);
+	ASSERT_EQ(hash_remove(h, 5 + NUM_BUCKETS), 1);
+	ASSERT_EQ(hash_remove(h, 6), 1);
+	ASSERT_EQ(hash_checkpoint(h, fileno(log)), 2);
+	ASSERT_EQ(checkpoint_matches(h, fileno(log)), 1);
+
+	//the deltas merged into a new base
+	lseek(fileno(log), 0, SEEK_SET);
+	ASSERT_EQ(hash_checkpoint_compact(fileno(log), fileno(base)), MAX_KEY - 2);
+	ASSERT_EQ(checkpoint_matches(h, fileno(base)), 1);
+
+	//checkpoints next to a writer still add up to the table
+	int running = 1;
+	ckpt_args_t args = { h, &running };
+	pthread_t writer;
+	pthread_create(&writer, NULL, thread_ckpt_writer, &args);
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		lseek(fileno(log), 0, SEEK_END);
+		ASSERT_GE(hash_checkpoint(h, fileno(log)), 0);
+	}
+	pthread_join(writer, NULL);
+	lseek(fileno(log), 0, SEEK_END);
+	ASSERT_GE(hash_checkpoint(h, fileno(log)), 0);
+	ASSERT_EQ(checkpoint_matches(h, fileno(log)), 1);
+
+	//void* values can't be saved, nor restored
+	hash_opts_t pointers = { .flags = HASH_CHECKPOINT };
+	ASSERT_NULL(hash_alloc_opts(BUCKETS, hash_f, &pointers));
+	hashtable_t *plain = hash_alloc(NUM_BUCKETS, hash_f);
+	lseek(fileno(base), 0, SEEK_SET);
+	ASSERT_EQ(hash_restore(plain, fileno(base)), -1);
+	ASSERT_EQ(hash_contains(plain, 0), 0);
+	ASSERT_EQ(hash_stop(plain), 1);
+	ASSERT_EQ(hash_free(plain), 1);
+
+	//a truncated stream is rejected
+	ftruncate(fileno(log), sizeof(int));
+	lseek(fileno(log), 0, SEEK_SET);
+	ASSERT_EQ(hash_checkpoint_compact(fileno(log), fileno(base)), -1);
+	fclose(log);
+	fclose(base);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	h = hash_alloc(BUCKETS, hash_f);
+	ASSERT_EQ(hash_checkpoint(h, 1), -1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+typedef struct counter_t {
+	lock_t lock;
+	long count;
+} counter_t;
+
+void* thread_count(void *args) {
+	counter_t* counter = args;
+	for (int i = 0; i < STRESS_CMDS * NUM_LOOPS; i++) {
+		lock_acquire(&counter->lock);
+		counter->count++;
+		lock_release(&counter->lock);
+	}
+	return NULL;
+}
+
+int TestHashActions_Lock() {
+	counter_t counter;
+	lock_init(&counter.lock);
+	counter.count = 0;
+	ASSERT_EQ(lock_try(&counter.lock), 1);
+	ASSERT_EQ(lock_try(&counter.lock), 0);
+	lock_release(&counter.lock);
+
+	//contended: parked threads must all be woken up
+	pthread_t threads[CMDS];
+	for (int i = 0; i < CMDS; i++) {
+		pthread_create(&threads[i], NULL, thread_count, &counter);
+	}
+	for (int i = 0; i < CMDS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	ASSERT_EQ(counter.count, CMDS * STRESS_CMDS * NUM_LOOPS);
+	ASSERT_EQ(counter.lock.state, LOCK_FREE);
+	return true;
+}
+
+
+int blocking, released;
+
+//holds the node lock of its key until released is set
+void* compute_block(void* val) {
+	__atomic_store_n(&blocking, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	return val;
+}
+
+void* thread_block(void *args) {
+	void* result;
+	list_node_compute(args, 0, compute_block, &result);
+	return NULL;
+}
+
+long elapsed_us(struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L
+			+ (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+int TestHashActions_TryOps() {
+	//one chain: 1 -> 0 -> 2
+	hashtable_t *h = hash_alloc(1, hash_f);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_try_insert(h, 1, NULL), 1);
+	ASSERT_EQ(hash_try_insert(h, 0, NULL), 1);
+	ASSERT_EQ(hash_try_insert(h, 2, NULL), 1);
+	ASSERT_EQ(hash_try_insert(h, 2, NULL), 0);
+	ASSERT_EQ(hash_try_contains(h, 3), 0);
+	void* val;
+	ASSERT_EQ(hash_try_compute(h, 1, compute_f, &val), 1);
+
+	blocking = released = 0;
+	pthread_t blocker;
+	pthread_create(&blocker, NULL, thread_block, h);
+	while (!__atomic_load_n(&blocking, __ATOMIC_ACQUIRE))
+		usleep(1000);
+
+	//the walk stops at the held node 0, before it is fine
+	ASSERT_EQ(hash_try_contains(h, 1), 1);
+	ASSERT_EQ(hash_try_update(h, 1, NULL), 1);
+	ASSERT_EQ(hash_try_contains(h, 0), HASH_BUSY);
+	ASSERT_EQ(hash_try_contains(h, 2), HASH_BUSY);
+	ASSERT_EQ(hash_try_get(h, 2, &val), HASH_BUSY);
+	ASSERT_EQ(hash_try_update(h, 2, NULL), HASH_BUSY);
+	ASSERT_EQ(hash_try_remove(h, 2), HASH_BUSY);
+	ASSERT_EQ(hash_try_compute(h, 0, compute_f, &val), HASH_BUSY);
+	ASSERT_EQ(hash_try_insert(h, 3, NULL), HASH_BUSY);
+
+	//the deadline variant waits out its budget, then gives up
+	op_t op = { .key = 3, .op = INSERT };
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ASSERT_EQ(hash_execute_timed(h, &op, 20000), HASH_BUSY);
+	ASSERT_EQ(op.result, HASH_BUSY);
+	ASSERT_EQ(elapsed_us(&start) >= 20000, 1);
+	ASSERT_EQ(hash_getbucketsize(h, 0), 3);
+
+	//and gets through once the lock is let go within it
+	__atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+	op = (op_t) { .key = 3, .op = INSERT };
+	ASSERT_EQ(hash_execute_timed(h, &op, 10000000), 1);
+	pthread_join(blocker, NULL);
+	ASSERT_EQ(hash_try_remove(h, 2), 1);
+	ASSERT_EQ(hash_try_contains(h, 3), 1);
+	ASSERT_EQ(hash_getbucketsize(h, 0), 3);
+	op = (op_t) { .key = 0, .op = COMPUTE };
+	ASSERT_EQ(hash_execute_timed(h, &op, 0), -1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_try_contains(h, 1), -1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the combiner is stuck in the blocker, try ops walk the bucket themselves
+	hash_opts_t opts = { .flags = HASH_TRANSACTIONS | HASH_FLAT_COMBINING };
+	h = hash_alloc_opts(1, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_try_insert(h, 0, NULL), 1);
+	blocking = released = 0;
+	pthread_create(&blocker, NULL, thread_block, h);
+	while (!__atomic_load_n(&blocking, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	ASSERT_EQ(hash_try_insert(h, 1, NULL), HASH_BUSY);
+	__atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+	pthread_join(blocker, NULL);
+	ASSERT_EQ(hash_try_insert(h, 1, NULL), 1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the eviction of a try insert passes over the held node 0
+	opts = (hash_opts_t) { .capacity = 2 };
+	h = hash_alloc_opts(2, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_insert(h, 0, NULL), 1);
+	ASSERT_EQ(hash_insert(h, 2, NULL), 1);
+	blocking = released = 0;
+	pthread_create(&blocker, NULL, thread_block, h);
+	while (!__atomic_load_n(&blocking, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	ASSERT_EQ(hash_try_insert(h, 1, NULL), 1);
+	ASSERT_EQ(hash_getbucketsize(h, 0) + hash_getbucketsize(h, 1), 2);
+	__atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+	pthread_join(blocker, NULL);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//a reseed waits for the blocker, the try inserts that call for it don't
+	opts = (hash_opts_t) { .flags = HASH_AUTO_RESEED, .seed = 12345 };
+	h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_insert(h, 0, NULL), 1);
+	blocking = released = 0;
+	pthread_create(&blocker, NULL, thread_block, h);
+	while (!__atomic_load_n(&blocking, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	int target = hash_getbucket(h, 0) ? 0 : 1;
+	int inserted = 0;
+	for (int key = 1; inserted < 2 * HASH_DEFAULT_MAX_CHAIN; key++) {
+		if (hash_getbucket(h, key) != target)
+			continue;
+		ASSERT_EQ(hash_try_insert(h, key, NULL), 1);
+		inserted++;
+	}
+	ASSERT_EQ(hash_getreseeds(h), 0);
+	__atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+	pthread_join(blocker, NULL);
+	ASSERT_EQ(hash_contains(h, 0), 1);
+	ASSERT_EQ(hash_getreseeds(h), 1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	opts = (hash_opts_t) { .flags = HASH_CUCKOO };
+	h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_try_insert(h, 0, NULL), -1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+#define STREAM_OPS (STRESS_CMDS * NUM_LOOPS)
+#define STREAM_THREADS 4
+
+typedef struct stream_args_t {
+	int produced, in_flight, max_in_flight;
+	int results[3]; //-1, 0, 1
+	int keys[MAX_KEY]; //removes minus inserts that went through
+} stream_args_t;
+
+//inserts every key of MAX_KEY then alternates removes and inserts
+int stream_next(void* ctx, op_t* op) {
+	stream_args_t* args = ctx;
+	if (args->produced == STREAM_OPS)
+		return 0;
+	int i = args->produced++;
+	*op = (op_t) { .key = i % MAX_KEY,
+			.op = (i < MAX_KEY || (i / MAX_KEY) % 2 == 0) ? INSERT : REMOVE };
+	int in_flight = __atomic_add_fetch(&args->in_flight, 1, __ATOMIC_RELAXED);
+	if (in_flight > args->max_in_flight)
+		args->max_in_flight = in_flight;
+	return 1;
+}
+
+void stream_done(void* ctx, op_t* op) {
+	stream_args_t* args = ctx;
+	__atomic_sub_fetch(&args->in_flight, 1, __ATOMIC_RELAXED);
+	args->results[op->result + 1]++;
+	if (op->result == 1)
+		args->keys[op->key] += op->op == INSERT ? 1 : -1;
+}
+
+int TestHashActions_BatchStream() {
+	hashtable_t *h = hash_alloc(BUCKETS, hash_f);
+	ASSERT_NOT_NULL(h);
+	stream_args_t args;
+	memset(&args, 0, sizeof(args));
+	ASSERT_EQ(hash_batch_stream(h, 0, stream_next, stream_done, &args), -1);
+	ASSERT_EQ(hash_batch_stream(h, STREAM_THREADS, NULL, NULL, &args), -1);
+
+	//far more ops than hash_batch could start threads for
+	ASSERT_EQ(hash_batch_stream(h, STREAM_THREADS, stream_next, stream_done,
+			&args), STREAM_OPS);
+	ASSERT_EQ(args.produced, STREAM_OPS);
+	ASSERT_EQ(args.in_flight, 0);
+	ASSERT_EQ(args.max_in_flight <= STREAM_THREADS, 1);
+	ASSERT_EQ(args.results[0], 0);
+	ASSERT_EQ(args.results[1] + args.results[2], STREAM_OPS);
+	int sum = 0;
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_contains(h, i), args.keys[i]);
+		sum += args.keys[i];
+	}
+	for (int i = 0; i < BUCKETS; i++) {
+		sum -= hash_getbucketsize(h, i);
+	}
+	ASSERT_EQ(sum, 0);
+
+	//done is optional
+	memset(&args, 0, sizeof(args));
+	ASSERT_EQ(hash_batch_stream(h, 1, stream_next, NULL, &args), STREAM_OPS);
+	ASSERT_EQ(hash_stop(h), 1);
+	memset(&args, 0, sizeof(args));
+	ASSERT_EQ(hash_batch_stream(h, STREAM_THREADS, stream_next, stream_done,
+			&args), -1);
+	ASSERT_EQ(args.produced, 0);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+#define NUMA_BUCKETS (3 * 4096)
+
+//spreads the keys below MAX_KEY over all the buckets
+int hash_spread(int buckets, int key) {
+	return key * 61 % buckets;
+}
+
+int TestHashActions_Numa() {
+	hash_opts_t opts = { .flags = HASH_NUMA, .numa_nodes = -1 };
+	ASSERT_NULL(hash_alloc_opts(NUMA_BUCKETS, hash_f, &opts));
+	opts.numa_nodes = 2;
+	hashtable_t *h = hash_alloc_opts(NUMA_BUCKETS, hash_spread, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_getnode(h, 0), 0);
+	ASSERT_EQ(hash_getnode(h, 2 * 4096 - 1), 0);
+	ASSERT_EQ(hash_getnode(h, 2 * 4096), 1);
+	ASSERT_EQ(hash_getnode(h, NUMA_BUCKETS - 1), 1);
+	ASSERT_EQ(hash_getnode(h, NUMA_BUCKETS), -1);
+
+	//nodes come from the arenas and go back to them
+	for (int round = 0; round < 2; round++) {
+		for (int i = 0; i < MAX_KEY; i++) {
+			ASSERT_EQ(hash_insert(h, i, &seen[i]), 1);
+		}
+		for (int i = 0; i < MAX_KEY; i += 2) {
+			ASSERT_EQ(hash_remove(h, i), 1);
+		}
+		for (int i = 0; i < MAX_KEY; i++) {
+			ASSERT_EQ(hash_contains(h, i), i % 2);
+			ASSERT_EQ(hash_remove(h, i), i % 2);
+		}
+	}
+
+	//batch threads run on the node of their bucket
+	op_t ops[MAX_KEY];
+	for (int i = 0; i < MAX_KEY; i++) {
+		ops[i] = (op_t) { .key = i, .val = &seen[i], .op = INSERT };
+	}
+	hash_batch(h, MAX_KEY, ops);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+	}
+
+	//stream ops wait for a thread of their node
+	stream_args_t args;
+	memset(&args, 0, sizeof(args));
+	for (int i = 0; i < MAX_KEY; i++) {
+		args.keys[i] = 1;
+	}
+	ASSERT_EQ(hash_batch_stream(h, 2 * STREAM_THREADS, stream_next,
+			stream_done, &args), STREAM_OPS);
+	ASSERT_EQ(args.in_flight, 0);
+	ASSERT_EQ(args.results[1] + args.results[2], STREAM_OPS);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_contains(h, i), args.keys[i]);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the machine's nodes, with inline values
+	opts = (hash_opts_t) { .flags = HASH_NUMA, .value_size = 100 };
+	h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_getnode(h, BUCKETS - 1), 0);
+	char value[100], out[100];
+	for (int i = 0; i < NUM_CMDS; i++) {
+		memset(value, i, sizeof(value));
+		ASSERT_EQ(hash_insert(h, i, value), 1);
+	}
+	for (int i = 0; i < NUM_CMDS; i++) {
+		memset(value, i, sizeof(value));
+		ASSERT_EQ(hash_get(h, i, out), 1);
+		ASSERT_EQ(memcmp(value, out, sizeof(value)), 0);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	h = hash_alloc(BUCKETS, hash_f);
+	ASSERT_EQ(hash_getnode(h, 0), 0);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+#define HUGE_KEYS (1 << 17)
+
+int TestHashActions_HugePages() {
+	//several arena chunks of nodes, whatever pages the machine can give
+	hash_opts_t opts = { .flags = HASH_HUGE_PAGES };
+	hashtable_t *h = hash_alloc_opts(HUGE_KEYS / 4, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < HUGE_KEYS; i++) {
+		ASSERT_EQ(hash_insert(h, i, &seen[i % MAX_KEY]), 1);
+	}
+	void* val;
+	for (int i = 0; i < HUGE_KEYS; i += 3) {
+		ASSERT_EQ(hash_get(h, i, &val), 1);
+		ASSERT_EQ(val == &seen[i % MAX_KEY], 1);
+		ASSERT_EQ(hash_remove(h, i), 1);
+	}
+	for (int i = 0; i < HUGE_KEYS; i++) {
+		ASSERT_EQ(hash_contains(h, i), i % 3 != 0);
+	}
+	ASSERT_EQ(hash_getnode(h, 0), 0);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the node slices of the bucket arrays are whole 2MB pages
+	opts = (hash_opts_t) { .flags = HASH_HUGE_PAGES | HASH_NUMA,
+			.numa_nodes = 2 };
+	h = hash_alloc_opts(NUMA_BUCKETS, hash_spread, &opts);
+	ASSERT_NOT_NULL(h);
+	ASSERT_EQ(hash_getnode(h, NUMA_BUCKETS - 1), 0);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_insert(h, i, NULL), 1);
+	}
+	ASSERT_EQ(hash_contains(h, MAX_KEY - 1), 1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_Transpose() {
+	unsigned long long lookups, hops;
+	hashtable_t *h = hash_alloc(1, hash_f);
+	ASSERT_EQ(hash_gethops(h, &lookups, &hops), -1);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//one chain 0 -> 9, the hot key 9 is at the tail
+	hash_opts_t opts = { .flags = HASH_TRANSPOSE | HASH_HOP_STATS };
+	h = hash_alloc_opts(1, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < CMDS * 2; i++) {
+		ASSERT_EQ(hash_insert(h, i, &seen[i]), 1);
+	}
+	ASSERT_EQ(hash_gethops(h, &lookups, &hops), 1);
+	ASSERT_EQ(lookups, 0);
+
+	//it moves up one node per lookup, then stays at the head
+	for (int i = 0; i < 20; i++) {
+		ASSERT_EQ(hash_contains(h, 9), 1);
+	}
+	ASSERT_EQ(hash_gethops(h, &lookups, &hops), 1);
+	ASSERT_EQ(lookups, 20);
+	ASSERT_EQ(hops, 10 + 9 + 8 + 7 + 6 + 5 + 4 + 3 + 2 + 11 * 1);
+
+	//a key looked up as often as the one before it stays behind it
+	void* val;
+	ASSERT_EQ(hash_get(h, 0, &val), 1);
+	ASSERT_EQ(val == &seen[0], 1);
+	ASSERT_EQ(hash_gethops(h, &lookups, &hops), 1);
+	ASSERT_EQ(hops, 65 + 2);
+	ASSERT_EQ(hash_get(h, 0, &val), 1);
+	ASSERT_EQ(hash_gethops(h, &lookups, &hops), 1);
+	ASSERT_EQ(hops, 67 + 2);
+
+	//the entries moved with their values
+	for (int i = 0; i < CMDS * 2; i++) {
+		ASSERT_EQ(hash_get(h, i, &val), 1);
+		ASSERT_EQ(val == &seen[i], 1);
+	}
+	ASSERT_EQ(list_node_compute(h, 9, compute_f, &val), 1);
+	ASSERT_EQ(val == &seen[9], 1);
+	ASSERT_EQ(hash_update(h, 8, &seen[0]), 1);
+	ASSERT_EQ(hash_get(h, 8, &val), 1);
+	ASSERT_EQ(val == &seen[0], 1);
+	ASSERT_EQ(hash_getbucketsize(h, 0), CMDS * 2);
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//inline values and concurrent ops
+	opts = (hash_opts_t) { .flags = HASH_TRANSPOSE, .value_size = 100 };
+	h = hash_alloc_opts(BUCKETS, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	char value[100], out[100];
+	for (int i = 0; i < MAX_KEY; i++) {
+		memset(value, i, sizeof(value));
+		ASSERT_EQ(hash_insert(h, i, value), 1);
+	}
+	op_t ops[NUM_CMDS];
+	char outs[NUM_CMDS][100];
+	for (int i = 0; i < NUM_CMDS; i++) {
+		//skewed: half of them on the last key of each bucket
+		int key = i % 2 ? MAX_KEY - 1 - i % BUCKETS : i % MAX_KEY;
+		ops[i] = (op_t) { .key = key, .val = outs[i], .op = GET };
+	}
+	hash_batch(h, NUM_CMDS, ops);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ASSERT_EQ(ops[i].result, 1);
+		memset(value, ops[i].key, sizeof(value));
+		ASSERT_EQ(memcmp(outs[i], value, sizeof(value)), 0);
+	}
+	for (int i = 0; i < MAX_KEY; i++) {
+		memset(value, i, sizeof(value));
+		ASSERT_EQ(hash_get(h, i, out), 1);
+		ASSERT_EQ(memcmp(out, value, sizeof(value)), 0);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+	return true;
+}
+
+
+int TestHashActions_Bloom() {
+	//every counter of a one bucket table gets stuck: nothing may be lost
+	hash_opts_t opts = { .flags = HASH_BLOOM | HASH_TRANSPOSE };
+	hashtable_t *h = hash_alloc_opts(1, hash_f, &opts);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < MAX_KEY; i += 2) {
+		ASSERT_EQ(hash_insert(h, i, &seen[i]), 1);
+	}
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_contains(h, i), i % 2 ? 0 : 1);
+	}
+	for (int i = 0; i < MAX_KEY; i += 2) {
+		ASSERT_EQ(hash_remove(h, i), 1);
+		ASSERT_EQ(hash_remove(h, i), 0);
+	}
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_contains(h, i), 0);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//keys counted out on remove, in again on insert
+	h = hash_alloc_opts(NUM_BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	void* val;
+	for (int loop = 0; loop < 3; loop++) {
+		for (int i = 0; i < MAX_KEY; i++) {
+			ASSERT_EQ(hash_insert(h, i, &seen[i]), 1);
+		}
+		for (int i = 0; i < MAX_KEY; i++) {
+			ASSERT_EQ(hash_get(h, i, &val), 1);
+			ASSERT_EQ(val == &seen[i], 1);
+			ASSERT_EQ(hash_contains(h, MAX_KEY + i), 0);
+			ASSERT_EQ(hash_get(h, MAX_KEY + i, &val), 0);
+			ASSERT_EQ(hash_update(h, MAX_KEY + i, NULL), 0);
+			ASSERT_EQ(list_node_compute(h, MAX_KEY + i, compute_f, &val), 0);
+			ASSERT_EQ(hash_remove(h, MAX_KEY + i), 0);
+		}
+		for (int i = loop % 2; i < MAX_KEY; i++) {
+			ASSERT_EQ(hash_remove(h, i), 1);
+		}
+		for (int i = 0; i < MAX_KEY; i++) {
+			ASSERT_EQ(hash_contains(h, i), i < loop % 2 ? 1 : 0);
+		}
+		if (loop % 2)
+			ASSERT_EQ(hash_remove(h, 0), 1);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//concurrent inserts and removes
+	h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	op_t ops[NUM_CMDS];
+	for (int i = 0; i < NUM_CMDS; i++) {
+		int key = i % MAX_KEY;
+		ops[i] = (op_t) { .key = key, .op = i < MAX_KEY ? INSERT : REMOVE };
+		if (i >= 2 * MAX_KEY)
+			ops[i].op = CONTAINS;
+	}
+	hash_batch(h, NUM_CMDS, ops);
+	for (int i = 0; i < MAX_KEY; i++) {
+		ASSERT_EQ(hash_remove(h, i), ops[i].result && !ops[MAX_KEY + i].result);
+		ASSERT_EQ(hash_contains(h, i), 0);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the keys that leave behind the ops: evicted, expired, swept, reseeded
+	evicted_count = 0;
+	opts = (hash_opts_t) { .flags = HASH_BLOOM | HASH_TTL | HASH_TOMBSTONES,
+			.sweep_ms = 1, .capacity = NUM_BUCKETS, .evict = evict_f };
+	h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		if (i % 2)
+			ASSERT_EQ(hash_insert(h, i, malloc(sizeof(int))), 1);
+		else
+			ASSERT_EQ(hash_insert_ttl(h, i, malloc(sizeof(int)), 10), 1);
+	}
+	usleep(50000);
+	for (int i = 0; i < NUM_CMDS; i++) {
+		if (hash_get(h, i, &val) == 1) {
+			ASSERT_EQ(i % 2, 1);
+			ASSERT_EQ(hash_remove(h, i), 1);
+			free(val);
+		}
+	}
+	for (int i = 0; i < NUM_CMDS; i++) {
+		ASSERT_EQ(hash_insert(h, i, NULL), 1);
+		ASSERT_EQ(hash_contains(h, i), 1);
+		ASSERT_EQ(hash_remove(h, i), 1);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	opts = (hash_opts_t) { .flags = HASH_BLOOM | HASH_AUTO_RESEED, .seed = 12345 };
+	h = hash_alloc_opts(BUCKETS, NULL, &opts);
+	ASSERT_NOT_NULL(h);
+	int target = hash_getbucket(h, 0);
+	int keys[3 * HASH_DEFAULT_MAX_CHAIN];
+	int nr_keys = 0;
+	for (int key = 0; nr_keys < 3 * HASH_DEFAULT_MAX_CHAIN; key++) {
+		if (hash_getbucket(h, key) == target)
+			keys[nr_keys++] = key;
+	}
+	for (int i = 0; i < nr_keys; i++) {
+		ASSERT_EQ(hash_insert(h, keys[i], NULL), 1);
+	}
+	ASSERT_GE(hash_getreseeds(h), 1);
+	for (int i = 0; i < nr_keys; i++) {
+		ASSERT_EQ(hash_contains(h, keys[i]), 1);
+		ASSERT_EQ(hash_remove(h, keys[i]), 1);
+		ASSERT_EQ(hash_contains(h, keys[i]), 0);
+	}
+	ASSERT_EQ(hash_stop(h), 1);
+	ASSERT_EQ(hash_free(h), 1);
+
+	//the cuckoo engine has no chains to filter
+	opts = (hash_opts_t) { .flags = HASH_BLOOM | HASH_CUCKOO };
+	ASSERT_NULL(hash_alloc_opts(BUCKETS, NULL, &opts));
+	return true;
+}
+
+
 int main() {
 	RUN_TEST(TestHashActions_Insert);
 	RUN_TEST(TestHashActions_ContainsAndRemove);
@@ -668,5 +2458,29 @@ int main() {
 	RUN_TEST(TestHashActions_GetSizeAndStop);
 	RUN_TEST(StressTestWithBatches);
 	RUN_TEST(TestHashSync);
+	RUN_TEST(TestHashActions_FlatCombining);
+	RUN_TEST(TestHashActions_Transaction);
+	RUN_TEST(TestHashActions_Reseed);
+	RUN_TEST(TestHashActions_PowerOfTwo);
+	RUN_TEST(TestHashActions_HashMany);
+	RUN_TEST(TestHashActions_Cuckoo);
+	RUN_TEST(TestHashActions_InlineValues);
+	RUN_TEST(TestHashActions_Eviction);
+	RUN_TEST(TestHashActions_Expiry);
+	RUN_TEST(TestHashActions_SweepLargeTable);
+	RUN_TEST(TestHashActions_Iterator);
+	RUN_TEST(TestHashActions_ComputeAll);
+	RUN_TEST(TestHashActions_Teardown);
+	RUN_TEST(TestHashActions_Tombstones);
+	RUN_TEST(TestHashActions_SharedMemory);
+	RUN_TEST(TestHashActions_ChangeFeed);
+	RUN_TEST(TestHashActions_Checkpoint);
+	RUN_TEST(TestHashActions_Lock);
+	RUN_TEST(TestHashActions_TryOps);
+	RUN_TEST(TestHashActions_BatchStream);
+	RUN_TEST(TestHashActions_Numa);
+	RUN_TEST(TestHashActions_HugePages);
+	RUN_TEST(TestHashActions_Transpose);
+	RUN_TEST(TestHashActions_Bloom);
 	return 0;
 }
@@ -0,0 +1,491 @@
+/*
+ * bench_hashtable.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Contention benchmarks. The chain walk one compares the node locks:
+ * threads walk a few shared chains hand-over-hand, like list_find does,
+ * once with the error checking mutexes the table used to have, once with
+ * plain mutexes and once with lock_t. The table one runs lookups and
+ * updates on a hashtable_t with few buckets. The stream ones run the same
+ * mix through hash_batch_stream on a big table, once plain and once with
+ * HASH_NUMA on nodes nodes (0 for the machine's). On one socket, nodes
+ * made up with -N, or a run under numactl --physcpubind, show the cost of
+ * the pinning and the arenas but not the gain of the placement.
+ * The lookup ones run random hash_contains on the same big table, once in
+ * 4KB pages and once with HASH_HUGE_PAGES, and count the dTLB load misses
+ * with perf_event_open (see /proc/sys/kernel/perf_event_paranoid). The
+ * missing ones do the same with 70% of the keys absent, once without and
+ * once with HASH_BLOOM.
+ * The skewed ones look up few hot keys, inserted last so they start at the
+ * tails of chains chains of length nodes, once as they are and once with
+ * HASH_TRANSPOSE, and print the nodes a lookup visits on average.
+ * Build it with -O2 -DNDEBUG, lock_t checks its owner otherwise:
+ *
+ *   gcc -std=gnu11 -O2 -DNDEBUG -pthread tools/bench_hashtable.c hashtable.c
+ *       lock.c cuckoo.c shmtable.c numa.c -o bench_hashtable -lrt
+ *
+ * usage: bench_hashtable [-t threads] [-b chains] [-l chain length] [-s seconds]
+ *                        [-B stream buckets] [-N nodes]
+ */
+
+#define _GNU_SOURCE //PTHREAD_MUTEX_ERRORCHECK_NP
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../hashtable.h"
+#include "../lock.h"
+
+typedef struct bench_t {
+	int threads, chains, length;
+	double seconds;
+	bool stop;
+	int buckets, nodes; //of the stream runs
+	int range; //keys the lookup runs pick from, the table has buckets of them
+} bench_t;
+
+typedef struct walker_t {
+	pthread_t thread;
+	bench_t* bench;
+	void* chains;
+	unsigned int seed;
+	long walks, hops;
+} walker_t;
+
+static double elapsed(struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void mutex_errorcheck_init(pthread_mutex_t* mutex) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK_NP);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void mutex_plain_init(pthread_mutex_t* mutex) {
+	pthread_mutex_init(mutex, NULL);
+}
+
+/*
+ * Chain walk benchmark of one lock type: every chain has a sentinel lock
+ * and length nodes, a walk looks for a random key of a random chain.
+ * Returns the walks per second, *hop_ns the cost of one step.
+ */
+#define BENCH_WALK(kind, lock_type, init, acquire, release) \
+typedef struct kind##_node_t { \
+	lock_type lock; \
+	int key; \
+	struct kind##_node_t* next; \
+} kind##_node_t; \
+\
+typedef struct kind##_chain_t { \
+	lock_type lock; \
+	kind##_node_t* head; \
+} kind##_chain_t; \
+\
+static void* kind##_walker(void* arg) { \
+	walker_t* walker = arg; \
+	bench_t* bench = walker->bench; \
+	kind##_chain_t* chains = walker->chains; \
+	long walks = 0, hops = 0; /* not in walker, next to the others' */ \
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) { \
+		kind##_chain_t* chain = &chains[rand_r(&walker->seed) % bench->chains]; \
+		int key = rand_r(&walker->seed) % bench->length; \
+		lock_type* prev = &chain->lock; \
+		acquire(prev); \
+		kind##_node_t* curr = chain->head; \
+		while (curr) { \
+			acquire(&curr->lock); \
+			release(prev); \
+			prev = &curr->lock; \
+			hops++; \
+			if (curr->key == key) \
+				break; \
+			curr = curr->next; \
+		} \
+		release(prev); \
+		walks++; \
+	} \
+	walker->walks = walks; \
+	walker->hops = hops; \
+	return NULL; \
+} \
+\
+static double kind##_run(bench_t* bench, double* hop_ns) { \
+	kind##_chain_t* chains = calloc(bench->chains, sizeof(*chains)); \
+	walker_t* walkers = calloc(bench->threads, sizeof(*walkers)); \
+	for (int c = 0; c < bench->chains; ++c) { \
+		init(&chains[c].lock); \
+		kind##_node_t** link = &chains[c].head; \
+		for (int k = 0; k < bench->length; ++k) { \
+			kind##_node_t* node = malloc(sizeof(*node)); \
+			init(&node->lock); \
+			node->key = k; \
+			node->next = NULL; \
+			*link = node; \
+			link = &node->next; \
+		} \
+	} \
+	bench->stop = false; \
+	struct timespec start; \
+	clock_gettime(CLOCK_MONOTONIC, &start); \
+	for (int i = 0; i < bench->threads; ++i) { \
+		walkers[i] = (walker_t) { .bench = bench, .chains = chains, .seed = i + 1 }; \
+		pthread_create(&walkers[i].thread, NULL, kind##_walker, &walkers[i]); \
+	} \
+	usleep(bench->seconds * 1e6); \
+	__atomic_store_n(&bench->stop, true, __ATOMIC_RELAXED); \
+	long walks = 0, hops = 0; \
+	for (int i = 0; i < bench->threads; ++i) { \
+		pthread_join(walkers[i].thread, NULL); \
+		walks += walkers[i].walks; \
+		hops += walkers[i].hops; \
+	} \
+	double seconds = elapsed(&start); \
+	for (int c = 0; c < bench->chains; ++c) { \
+		kind##_node_t* node = chains[c].head; \
+		while (node) { \
+			kind##_node_t* next = node->next; \
+			free(node); \
+			node = next; \
+		} \
+	} \
+	free(chains); \
+	free(walkers); \
+	*hop_ns = hops ? seconds * 1e9 * bench->threads / hops : 0; \
+	return walks / seconds; \
+}
+
+BENCH_WALK(errorcheck, pthread_mutex_t, mutex_errorcheck_init,
+		pthread_mutex_lock, pthread_mutex_unlock)
+BENCH_WALK(mutex, pthread_mutex_t, mutex_plain_init, pthread_mutex_lock,
+		pthread_mutex_unlock)
+BENCH_WALK(lock, lock_t, lock_init, lock_acquire, lock_release)
+
+static void* void_increment(void* val) {
+	return (void*) ((intptr_t) val + 1);
+}
+
+static void* table_worker(void* arg) {
+	walker_t* walker = arg;
+	bench_t* bench = walker->bench;
+	hashtable_t* table = walker->chains;
+	int keys = bench->chains * bench->length;
+	void* result;
+	long ops = 0;
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		int key = rand_r(&walker->seed) % keys;
+		if (rand_r(&walker->seed) % 10)
+			hash_contains(table, key);
+		else
+			list_node_compute(table, key, void_increment, &result);
+		ops++;
+	}
+	walker->walks = ops;
+	return NULL;
+}
+
+/*
+ * Auxiliary function:
+ * lookups, one in ten a compute, on a table of chains buckets holding
+ * length keys each. returns the ops per second
+ */
+static double table_run(bench_t* bench) {
+	hashtable_t* table = hash_alloc_opts(bench->chains, NULL, NULL);
+	for (int key = 0; key < bench->chains * bench->length; ++key) {
+		hash_insert(table, key, NULL);
+	}
+	walker_t* workers = calloc(bench->threads, sizeof(*workers));
+	bench->stop = false;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < bench->threads; ++i) {
+		workers[i] = (walker_t) { .bench = bench, .chains = table, .seed = i + 1 };
+		pthread_create(&workers[i].thread, NULL, table_worker, &workers[i]);
+	}
+	usleep(bench->seconds * 1e6);
+	__atomic_store_n(&bench->stop, true, __ATOMIC_RELAXED);
+	long ops = 0;
+	for (int i = 0; i < bench->threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].walks;
+	}
+	double seconds = elapsed(&start);
+	free(workers);
+	hash_stop(table);
+	hash_free(table);
+	return ops / seconds;
+}
+
+typedef struct stream_bench_t {
+	bench_t* bench;
+	unsigned int seed;
+	long produced;
+	struct timespec start;
+} stream_bench_t;
+
+static int stream_next(void* ctx, op_t* op) {
+	stream_bench_t* stream = ctx;
+	if (stream->produced % 1024 == 0
+			&& elapsed(&stream->start) >= stream->bench->seconds)
+		return 0;
+	stream->produced++;
+	int key = rand_r(&stream->seed) % stream->bench->buckets;
+	if (rand_r(&stream->seed) % 10)
+		*op = (op_t) { .key = key, .op = CONTAINS };
+	else
+		*op = (op_t) { .key = key, .op = COMPUTE, .compute_func = void_increment };
+	return 1;
+}
+
+/*
+ * Auxiliary function:
+ * the table_run mix as a stream, on as many keys as buckets.
+ * returns the ops per second
+ */
+static double stream_run(bench_t* bench, int flags) {
+	hash_opts_t opts = { .flags = flags, .numa_nodes = bench->nodes };
+	hashtable_t* table = hash_alloc_opts(bench->buckets, NULL, &opts);
+	if (!table)
+		return 0;
+	for (int key = 0; key < bench->buckets; ++key) {
+		hash_insert(table, key, NULL);
+	}
+	stream_bench_t stream = { .bench = bench, .seed = 1 };
+	clock_gettime(CLOCK_MONOTONIC, &stream.start);
+	long ops = hash_batch_stream(table, bench->threads, stream_next, NULL,
+			&stream);
+	double seconds = elapsed(&stream.start);
+	hash_stop(table);
+	hash_free(table);
+	return ops / seconds;
+}
+
+/*
+ * Auxiliary function:
+ * counter of the dTLB load misses of this thread and of the threads it
+ * starts from now on, -1 if perf events aren't allowed
+ */
+static int dtlb_open() {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_DTLB
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void* lookup_worker(void* arg) {
+	walker_t* walker = arg;
+	bench_t* bench = walker->bench;
+	long ops = 0;
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		hash_contains(walker->chains, rand_r(&walker->seed) % bench->range);
+		ops++;
+	}
+	walker->walks = ops;
+	return NULL;
+}
+
+/*
+ * Auxiliary function:
+ * random lookups of keys below range on a table of as many keys as
+ * buckets. returns the ops per second,
+ * *misses the dTLB load misses per lookup, -1 if they can't be counted
+ */
+static double lookup_run(bench_t* bench, int flags, double* misses) {
+	hash_opts_t opts = { .flags = flags };
+	hashtable_t* table = hash_alloc_opts(bench->buckets, NULL, &opts);
+	*misses = -1;
+	if (!table)
+		return 0;
+	for (int key = 0; key < bench->buckets; ++key) {
+		hash_insert(table, key, NULL);
+	}
+	walker_t* workers = calloc(bench->threads, sizeof(*workers));
+	int counter = dtlb_open();
+	bench->stop = false;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (counter >= 0)
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	for (int i = 0; i < bench->threads; ++i) {
+		workers[i] = (walker_t) { .bench = bench, .chains = table, .seed = i + 1 };
+		pthread_create(&workers[i].thread, NULL, lookup_worker, &workers[i]);
+	}
+	usleep(bench->seconds * 1e6);
+	__atomic_store_n(&bench->stop, true, __ATOMIC_RELAXED);
+	long ops = 0;
+	for (int i = 0; i < bench->threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].walks;
+	}
+	double seconds = elapsed(&start);
+	if (counter >= 0) {
+		//the counts of the exited threads are folded into it
+		long long count;
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &count, sizeof(count)) == sizeof(count) && ops)
+			*misses = (double) count / ops;
+		close(counter);
+	}
+	free(workers);
+	hash_stop(table);
+	hash_free(table);
+	return ops / seconds;
+}
+
+/*
+ * Auxiliary function:
+ * prints a lookup run
+ */
+static void lookup_print(const char* name, double ops, double misses) {
+	if (misses < 0)
+		printf("%-22s %12.0f ops/s   dTLB misses n/a\n", name, ops);
+	else
+		printf("%-22s %12.0f ops/s %8.3f dTLB misses/op\n", name, ops, misses);
+}
+
+static void* skew_worker(void* arg) {
+	walker_t* walker = arg;
+	bench_t* bench = walker->bench;
+	int keys = bench->chains * bench->length;
+	long ops = 0;
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		//key k is picked with probability about ln(keys / (k + 1)) / keys
+		int bound = rand_r(&walker->seed) % keys + 1;
+		hash_contains(walker->chains, rand_r(&walker->seed) % bound);
+		ops++;
+	}
+	walker->walks = ops;
+	return NULL;
+}
+
+/*
+ * Auxiliary function:
+ * skewed lookups on chains chains of length nodes, the keys inserted in
+ * descending order. returns the ops per second, *hops the nodes a lookup
+ * visits on average
+ */
+static double skew_run(bench_t* bench, int flags, double* hops) {
+	hash_opts_t opts = { .flags = flags | HASH_HOP_STATS };
+	hashtable_t* table = hash_alloc_opts(bench->chains, NULL, &opts);
+	*hops = 0;
+	if (!table)
+		return 0;
+	for (int key = bench->chains * bench->length - 1; key >= 0; --key) {
+		hash_insert(table, key, NULL);
+	}
+	walker_t* workers = calloc(bench->threads, sizeof(*workers));
+	bench->stop = false;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < bench->threads; ++i) {
+		workers[i] = (walker_t) { .bench = bench, .chains = table, .seed = i + 1 };
+		pthread_create(&workers[i].thread, NULL, skew_worker, &workers[i]);
+	}
+	usleep(bench->seconds * 1e6);
+	__atomic_store_n(&bench->stop, true, __ATOMIC_RELAXED);
+	long ops = 0;
+	for (int i = 0; i < bench->threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].walks;
+	}
+	double seconds = elapsed(&start);
+	unsigned long long lookups, visited;
+	if (hash_gethops(table, &lookups, &visited) == 1 && lookups)
+		*hops = (double) visited / lookups;
+	free(workers);
+	hash_stop(table);
+	hash_free(table);
+	return ops / seconds;
+}
+
+int main(int argc, char* argv[]) {
+	bench_t bench = { .threads = 8, .chains = 4, .length = 16, .seconds = 1,
+			.buckets = 1 << 20 };
+	int opt;
+	while ((opt = getopt(argc, argv, "t:b:l:s:B:N:")) != -1) {
+		switch (opt) {
+		case 't':
+			bench.threads = atoi(optarg);
+			break;
+		case 'b':
+			bench.chains = atoi(optarg);
+			break;
+		case 'l':
+			bench.length = atoi(optarg);
+			break;
+		case 's':
+			bench.seconds = atof(optarg);
+			break;
+		case 'B':
+			bench.buckets = atoi(optarg);
+			break;
+		case 'N':
+			bench.nodes = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-b chains] [-l chain length] "
+					"[-s seconds] [-B stream buckets] [-N nodes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (bench.threads < 1 || bench.chains < 1 || bench.length < 1
+			|| bench.seconds <= 0 || bench.buckets < 1 || bench.nodes < 0) {
+		fprintf(stderr, "bad arguments\n");
+		return 1;
+	}
+
+	printf("%d threads, %d chains of %d nodes, %.1f s per run\n", bench.threads,
+			bench.chains, bench.length, bench.seconds);
+	double hop_ns;
+	double walks = errorcheck_run(&bench, &hop_ns);
+	printf("%-22s %12.0f walks/s %8.1f ns/hop\n", "errorcheck mutex", walks,
+			hop_ns);
+	walks = mutex_run(&bench, &hop_ns);
+	printf("%-22s %12.0f walks/s %8.1f ns/hop\n", "plain mutex", walks, hop_ns);
+	walks = lock_run(&bench, &hop_ns);
+	printf("%-22s %12.0f walks/s %8.1f ns/hop\n", "lock_t", walks, hop_ns);
+	printf("%-22s %12.0f ops/s\n", "hashtable_t", table_run(&bench));
+	printf("%-22s %12.0f ops/s\n", "stream", stream_run(&bench, 0));
+	printf("%-22s %12.0f ops/s\n", "stream HASH_NUMA",
+			stream_run(&bench, HASH_NUMA));
+	double misses;
+	bench.range = bench.buckets;
+	double ops = lookup_run(&bench, 0, &misses);
+	lookup_print("lookups", ops, misses);
+	ops = lookup_run(&bench, HASH_HUGE_PAGES, &misses);
+	lookup_print("lookups huge pages", ops, misses);
+	bench.range = bench.buckets / 3 * 10;
+	ops = lookup_run(&bench, 0, &misses);
+	lookup_print("missing", ops, misses);
+	ops = lookup_run(&bench, HASH_BLOOM, &misses);
+	lookup_print("missing HASH_BLOOM", ops, misses);
+	double hops;
+	ops = skew_run(&bench, 0, &hops);
+	printf("%-22s %12.0f ops/s %8.1f hops/op\n", "skewed", ops, hops);
+	ops = skew_run(&bench, HASH_TRANSPOSE, &hops);
+	printf("%-22s %12.0f ops/s %8.1f hops/op\n", "skewed HASH_TRANSPOSE", ops,
+			hops);
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * hash_client.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hash_client.h"
+
+#define CLIENT_REQUESTS 512 //requests queued before they are sent on their own
+#define CLIENT_RESPONSES 512 //responses read at once
+
+struct hash_client_t {
+	int fd;
+	uint32_t next_id;
+	int queued;
+	size_t got, used; //bytes of responses read, and handed out
+	hash_request_t requests[CLIENT_REQUESTS];
+	hash_response_t responses[CLIENT_RESPONSES];
+};
+
+hash_client_t* hash_client_connect(const char* path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (!path || strlen(path) >= sizeof(addr.sun_path))
+		return NULL;
+	strcpy(addr.sun_path, path);
+
+	hash_client_t* client = calloc(1, sizeof(*client));
+	if (!client)
+		return NULL;
+	client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (client->fd < 0
+			|| connect(client->fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		if (client->fd >= 0)
+			close(client->fd);
+		free(client);
+		return NULL;
+	}
+	return client;
+}
+
+void hash_client_close(hash_client_t* client) {
+	if (!client)
+		return;
+	close(client->fd);
+	free(client);
+}
+
+int hash_client_flush(hash_client_t* client) {
+	if (!client)
+		return -1;
+	size_t size = client->queued * sizeof(hash_request_t);
+	size_t sent = 0;
+	while (sent < size) {
+		ssize_t n = send(client->fd, (char*) client->requests + sent,
+				size - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		sent += n;
+	}
+	client->queued = 0;
+	return 0;
+}
+
+long hash_client_send(hash_client_t* client, int op, int key, int64_t val,
+		int func) {
+	if (!client)
+		return -1;
+	if (client->queued == CLIENT_REQUESTS && hash_client_flush(client) < 0)
+		return -1;
+	hash_request_t* request = &client->requests[client->queued++];
+	memset(request, 0, sizeof(*request));
+	request->id = client->next_id++;
+	request->op = op;
+	request->key = key;
+	request->val = val;
+	request->func = func;
+	return request->id;
+}
+
+int hash_client_recv(hash_client_t* client, hash_response_t* response) {
+	if (!client || !response)
+		return -1;
+	if (client->queued && hash_client_flush(client) < 0)
+		return -1;
+	while (client->got - client->used < sizeof(hash_response_t)) {
+		//keep the partial response, read the rest behind it
+		size_t rest = client->got - client->used;
+		memmove(client->responses, (char*) client->responses + client->used,
+				rest);
+		client->got = rest;
+		client->used = 0;
+		ssize_t n = recv(client->fd, (char*) client->responses + client->got,
+				sizeof(client->responses) - client->got, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		client->got += n;
+	}
+	memcpy(response, (char*) client->responses + client->used,
+			sizeof(*response));
+	client->used += sizeof(*response);
+	return 1;
+}
+
+int hash_client_call(hash_client_t* client, int op, int key, int64_t val,
+		int func, int64_t* out) {
+	hash_response_t response;
+	if (hash_client_send(client, op, key, val, func) < 0
+			|| hash_client_recv(client, &response) < 0)
+		return -1;
+	if (out)
+		*out = response.val;
+	return response.result;
+}
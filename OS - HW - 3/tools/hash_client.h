@@ -0,0 +1,41 @@
+/*
+ * hash_client.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Client of hash_server. Requests are queued and sent in bulk, so many
+ * of them can be in flight on one connection; responses are read back in
+ * the order the requests were queued. A client is used by one thread.
+ * Keep the requests in flight to a few thousand: the server stops reading
+ * from a client that doesn't read its responses.
+ */
+
+#ifndef HASH_CLIENT_H_
+#define HASH_CLIENT_H_
+
+#include "hash_protocol.h"
+
+struct hash_client_t;
+typedef struct hash_client_t hash_client_t;
+
+hash_client_t* hash_client_connect(const char* path);
+void hash_client_close(hash_client_t* client);
+/*
+ * Queues a request, returns its id or -1. func is one of HASH_FN_* for
+ * COMPUTE and ignored otherwise. Full buffers are sent on their own.
+ */
+long hash_client_send(hash_client_t* client, int op, int key, int64_t val,
+                      int func);
+/* sends the queued requests, returns 0 or -1 */
+int hash_client_flush(hash_client_t* client);
+/* waits for the next response, flushing first. returns 1, or -1 if the connection broke */
+int hash_client_recv(hash_client_t* client, hash_response_t* response);
+/*
+ * One round trip: returns the result of the op, or -1 if the connection
+ * broke. *out gets the value of GET and COMPUTE, it may be NULL.
+ */
+int hash_client_call(hash_client_t* client, int op, int key, int64_t val,
+                     int func, int64_t* out);
+
+#endif /* HASH_CLIENT_H_ */
@@ -0,0 +1,189 @@
+/*
+ * hash_loadgen.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Load generator for hash_server: every connection runs on its own thread
+ * and keeps depth requests in flight, a round being depth requests sent
+ * at once and their responses read back. Prints the throughput, the cost
+ * of one request end to end and the latency percentiles of a round.
+ *
+ * usage: hash_loadgen [-s socket path] [-c connections] [-d depth]
+ *                     [-n requests per connection] [-k keys] [-r read percent]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash_client.h"
+
+typedef struct load_t {
+	pthread_t thread;
+	const char* path;
+	int depth, keys, read_percent;
+	long requests;
+	unsigned int seed;
+	long rounds, failed;
+	long answered; //requests sent that got a response
+	uint64_t* latencies; //ns per round
+}* Load;
+
+static uint64_t now_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Auxiliary function:
+ * a random op of the mix: reads are split between CONTAINS and GET,
+ * writes between INSERT, UPDATE, COMPUTE and REMOVE
+ */
+static int random_op(Load load) {
+	int dice = rand_r(&load->seed) % 100;
+	if (dice < load->read_percent)
+		return dice % 2 ? CONTAINS : GET;
+	static const int writes[] = { INSERT, INSERT, UPDATE, COMPUTE, REMOVE };
+	return writes[rand_r(&load->seed) % 5];
+}
+
+/*
+ * Auxiliary function:
+ * sends count requests at once and reads their responses back.
+ * returns 0, or -1 if the connection broke
+ */
+static int load_round(Load load, hash_client_t* client, long count) {
+	hash_response_t response;
+	for (long i = 0; i < count; ++i) {
+		int key = rand_r(&load->seed) % load->keys;
+		if (hash_client_send(client, random_op(load), key, key,
+				HASH_FN_INCREMENT) < 0)
+			return -1;
+	}
+	for (long i = 0; i < count; ++i) {
+		if (hash_client_recv(client, &response) < 0)
+			return -1;
+		load->answered++;
+		if (response.result < 0)
+			load->failed++;
+	}
+	return 0;
+}
+
+static void* load_routine(void* arg) {
+	Load load = arg;
+	hash_client_t* client = hash_client_connect(load->path);
+	if (!client) {
+		load->failed = load->requests;
+		return NULL;
+	}
+	while (load->answered < load->requests) {
+		//the last round sends what is left
+		long count = load->requests - load->answered;
+		if (count > load->depth)
+			count = load->depth;
+		uint64_t start = now_ns();
+		if (load_round(load, client, count) < 0) {
+			//what wasn't answered failed
+			load->failed += load->requests - load->answered;
+			break;
+		}
+		load->latencies[load->rounds++] = now_ns() - start;
+	}
+	hash_client_close(client);
+	return NULL;
+}
+
+static int latency_compare(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+	const char* path = HASH_SOCKET_PATH;
+	int connections = 4, depth = 64, keys = 10000, read_percent = 80;
+	long requests = 1000000;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:c:d:n:k:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'n':
+			requests = atol(optarg);
+			break;
+		case 'k':
+			keys = atoi(optarg);
+			break;
+		case 'r':
+			read_percent = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s path] [-c connections] [-d depth] "
+					"[-n requests] [-k keys] [-r read percent]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (connections < 1 || depth < 1 || requests < 1 || keys < 1
+			|| read_percent < 0 || read_percent > 100) {
+		fprintf(stderr, "bad arguments\n");
+		return 1;
+	}
+
+	long rounds = (requests + depth - 1) / depth;
+	struct load_t* loads = calloc(connections, sizeof(*loads));
+	uint64_t* latencies = malloc(sizeof(uint64_t) * rounds * connections);
+	if (!loads || !latencies) {
+		perror("hash_loadgen");
+		return 1;
+	}
+	uint64_t start = now_ns();
+	for (int i = 0; i < connections; ++i) {
+		loads[i] = (struct load_t) { .path = path, .depth = depth, .keys = keys,
+			.read_percent = read_percent, .requests = requests, .seed = i + 1,
+			.latencies = latencies + rounds * i };
+		pthread_create(&loads[i].thread, NULL, load_routine, &loads[i]);
+	}
+	long done = 0, failed = 0, answered = 0;
+	for (int i = 0; i < connections; ++i) {
+		pthread_join(loads[i].thread, NULL);
+		//compact the rounds every connection actually ran
+		memmove(latencies + done, loads[i].latencies,
+				sizeof(uint64_t) * loads[i].rounds);
+		done += loads[i].rounds;
+		failed += loads[i].failed;
+		answered += loads[i].answered;
+	}
+	double seconds = (now_ns() - start) / 1e9;
+
+	if (!done) {
+		fprintf(stderr, "no round completed, is hash_server running on %s?\n",
+				path);
+		return 1;
+	}
+	qsort(latencies, done, sizeof(uint64_t), latency_compare);
+	double total = answered;
+	printf("%.0f requests in %.2f s over %d connections, depth %d\n", total,
+			seconds, connections, depth);
+	printf("throughput %.0f requests/s, %.0f ns per request\n",
+			total / seconds, seconds * 1e9 * connections / total);
+	printf("round latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			latencies[done / 2] / 1e3, latencies[done * 99 / 100] / 1e3,
+			latencies[done - 1] / 1e3);
+	if (failed)
+		printf("%ld requests failed\n", failed);
+	free(latencies);
+	free(loads);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * hash_protocol.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Wire format between hash_server and the hash_client library: fixed size
+ * requests and responses in host byte order, the socket being local.
+ * A client may send any number of requests before it reads the responses,
+ * the responses of a connection come back in request order.
+ */
+
+#ifndef HASH_PROTOCOL_H_
+#define HASH_PROTOCOL_H_
+
+#include <stdint.h>
+
+#include "../hashtable.h"
+
+#define HASH_SOCKET_PATH "/tmp/hashtable.sock"
+
+/* functions COMPUTE can apply, registered by the server */
+enum {
+	HASH_FN_INCREMENT, HASH_FN_DECREMENT, HASH_FN_DOUBLE, HASH_FN_COUNT
+};
+
+typedef struct hash_request_t {
+	int64_t val;      /* INSERT, UPDATE: the value */
+	uint32_t id;      /* echoed in the response */
+	int32_t key;
+	uint8_t op;       /* INSERT, REMOVE, CONTAINS, UPDATE, COMPUTE or GET of op_t */
+	uint8_t func;     /* COMPUTE: one of HASH_FN_* */
+	uint16_t reserved;
+	uint32_t reserved2;
+} hash_request_t;
+
+typedef struct hash_response_t {
+	int64_t val;      /* GET: the value, COMPUTE: the value after the function */
+	uint32_t id;
+	int32_t result;   /* what the hash_* function returned */
+} hash_response_t;
+
+_Static_assert(sizeof(hash_request_t) == 24, "hash_request_t is 24 bytes on the wire");
+_Static_assert(sizeof(hash_response_t) == 16, "hash_response_t is 16 bytes on the wire");
+
+#endif /* HASH_PROTOCOL_H_ */
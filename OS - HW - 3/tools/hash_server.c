@@ -0,0 +1,396 @@
+/*
+ * hash_server.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: lena
+ *
+ * Serves one hashtable_t over a Unix domain socket, see hash_protocol.h.
+ * The accepting thread hands connections round robin to worker threads,
+ * each with its own epoll set. A worker decodes every request one read
+ * brought in and applies them in order, then sends all their responses
+ * with one write. While a client doesn't read its responses the worker
+ * stops reading its requests.
+ *
+ * usage: hash_server [-s socket path] [-b buckets] [-w workers]
+ */
+
+#define _GNU_SOURCE //accept4, ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hash_protocol.h"
+
+#define DEFAULT_BUCKETS 4096
+#define DEFAULT_WORKERS 4
+#define CONN_REQUESTS 1024 //requests decoded from one read
+#define CONN_ROUNDS 16 //reads served per event before the other connections
+#define EVENTS 64
+#define STOP_POLL_MS 100
+
+typedef struct conn_t {
+	int fd;
+	uint32_t events; //EPOLLIN, or EPOLLOUT while responses are waiting
+	size_t in_used, out_used, out_sent;
+	struct conn_t *prev, *next;
+	_Alignas(8) unsigned char in[CONN_REQUESTS * sizeof(hash_request_t)];
+	hash_response_t out[CONN_REQUESTS];
+}* Conn;
+
+typedef struct worker_t {
+	pthread_t thread;
+	int epfd;
+	hashtable_t* table;
+	pthread_mutex_t conns_lock;
+	Conn conns; //open connections, for the shutdown
+}* Worker;
+
+static volatile sig_atomic_t stopping;
+
+//-----------------------------------------------------//
+//Registered compute functions: values are stored inline as int64_t,
+//the functions change them in place and return the new value
+
+static void* fn_increment(void* val) {
+	return (void*) (intptr_t) ++*(int64_t*) val;
+}
+
+static void* fn_decrement(void* val) {
+	return (void*) (intptr_t) --*(int64_t*) val;
+}
+
+static void* fn_double(void* val) {
+	return (void*) (intptr_t) (*(int64_t*) val *= 2);
+}
+
+static void* (* const compute_funcs[HASH_FN_COUNT])(void*) = {
+	[HASH_FN_INCREMENT] = fn_increment,
+	[HASH_FN_DECREMENT] = fn_decrement,
+	[HASH_FN_DOUBLE] = fn_double,
+};
+
+//-----------------------------------------------------//
+//Auxiliary functions:
+
+static void on_signal(int signal) {
+	(void) signal; //SIGINT and SIGTERM both stop the server
+	stopping = 1;
+}
+
+static void execute(hashtable_t* table, const hash_request_t* request,
+		hash_response_t* response) {
+	int64_t val = request->val;
+	void* result;
+
+	response->id = request->id;
+	response->val = 0;
+	switch (request->op) {
+	case INSERT:
+		response->result = hash_insert(table, request->key, &val);
+		break;
+	case REMOVE:
+		response->result = hash_remove(table, request->key);
+		break;
+	case CONTAINS:
+		response->result = hash_contains(table, request->key);
+		break;
+	case UPDATE:
+		response->result = hash_update(table, request->key, &val);
+		break;
+	case COMPUTE:
+		if (request->func >= HASH_FN_COUNT) {
+			response->result = -1;
+			break;
+		}
+		response->result = list_node_compute(table, request->key,
+				compute_funcs[request->func], &result);
+		if (response->result == 1)
+			response->val = (intptr_t) result;
+		break;
+	case GET:
+		response->result = hash_get(table, request->key, &val);
+		if (response->result == 1)
+			response->val = val;
+		break;
+	default:
+		response->result = -1;
+	}
+}
+
+static int conn_wait(Worker worker, Conn conn, uint32_t events) {
+	if (conn->events == events)
+		return 0;
+	struct epoll_event event = { .events = events, .data.ptr = conn };
+	conn->events = events;
+	return epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+/*
+ * Auxiliary function:
+ * sends what is left of the responses. returns 1 when all of them went
+ * out, 0 if the socket is full, -1 if the connection broke
+ */
+static int conn_flush(Conn conn) {
+	while (conn->out_sent < conn->out_used) {
+		ssize_t sent = send(conn->fd, (char*) conn->out + conn->out_sent,
+				conn->out_used - conn->out_sent, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (sent <= 0)
+			return -1;
+		conn->out_sent += sent;
+	}
+	conn->out_used = conn->out_sent = 0;
+	return 1;
+}
+
+/*
+ * Auxiliary function:
+ * reads requests and answers them until the socket is drained, the client
+ * stops reading or the connection had its share.
+ * returns -1 when the connection is over
+ */
+static int conn_serve(Worker worker, Conn conn) {
+	for (int round = 0; round < CONN_ROUNDS; ++round) {
+		ssize_t got = recv(conn->fd, conn->in + conn->in_used,
+				sizeof(conn->in) - conn->in_used, 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return conn_wait(worker, conn, EPOLLIN);
+		if (got <= 0)
+			return -1;
+		conn->in_used += got;
+
+		/*
+		 * the whole pipeline that arrived is applied in order, one request
+		 * at a time: a client may depend on its own writes, which
+		 * hash_batch_stream would run in parallel, and the workers already
+		 * spread the connections over the cpus
+		 */
+		size_t count = conn->in_used / sizeof(hash_request_t);
+		const hash_request_t* requests = (const hash_request_t*) conn->in;
+		for (size_t i = 0; i < count; ++i) {
+			execute(worker->table, &requests[i], &conn->out[i]);
+		}
+		conn->out_used = count * sizeof(hash_response_t);
+		size_t rest = conn->in_used - count * sizeof(hash_request_t);
+		memmove(conn->in, conn->in + count * sizeof(hash_request_t), rest);
+		conn->in_used = rest;
+
+		int flushed = conn_flush(conn);
+		if (flushed < 0)
+			return -1;
+		if (!flushed)
+			return conn_wait(worker, conn, EPOLLOUT);
+	}
+	return 0;
+}
+
+static void conn_close(Worker worker, Conn conn) {
+	epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	pthread_mutex_lock(&worker->conns_lock);
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		worker->conns = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+	pthread_mutex_unlock(&worker->conns_lock);
+	free(conn);
+}
+
+/*
+ * Auxiliary function:
+ * hands the accepted socket to the worker, closes it on failure
+ */
+static int conn_open(Worker worker, int fd) {
+	Conn conn = malloc(sizeof(*conn));
+	if (!conn) {
+		close(fd);
+		return -1;
+	}
+	conn->fd = fd;
+	conn->events = EPOLLIN;
+	conn->in_used = conn->out_used = conn->out_sent = 0;
+	conn->prev = NULL;
+
+	pthread_mutex_lock(&worker->conns_lock);
+	conn->next = worker->conns;
+	if (worker->conns)
+		worker->conns->prev = conn;
+	worker->conns = conn;
+	pthread_mutex_unlock(&worker->conns_lock);
+
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		conn_close(worker, conn);
+		return -1;
+	}
+	return 0;
+}
+
+static void* worker_routine(void* arg) {
+	Worker worker = arg;
+	struct epoll_event events[EVENTS];
+
+	while (!stopping) {
+		int ready = epoll_wait(worker->epfd, events, EVENTS, STOP_POLL_MS);
+		for (int i = 0; i < ready; ++i) {
+			Conn conn = events[i].data.ptr;
+			int res;
+			if (conn->events == EPOLLOUT) {
+				//the client read again, go back to its requests
+				res = conn_flush(conn);
+				if (res > 0)
+					res = conn_wait(worker, conn, EPOLLIN) < 0 ?
+							-1 : conn_serve(worker, conn);
+			} else {
+				res = conn_serve(worker, conn);
+			}
+			if (res < 0)
+				conn_close(worker, conn);
+		}
+	}
+	return NULL;
+}
+
+static int listen_on(const char* path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	//accept never blocks, a connection reset after ppoll saw it is skipped
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+			|| listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//-----------------------------------------------------//
+
+int main(int argc, char* argv[]) {
+	const char* path = HASH_SOCKET_PATH;
+	int buckets = DEFAULT_BUCKETS, nr_workers = DEFAULT_WORKERS;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:b:w:")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'b':
+			buckets = atoi(optarg);
+			break;
+		case 'w':
+			nr_workers = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s path] [-b buckets] [-w workers]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (buckets < 1 || nr_workers < 1) {
+		fprintf(stderr, "buckets and workers must be positive\n");
+		return 1;
+	}
+
+	hash_opts_t opts = { .value_size = sizeof(int64_t) };
+	hashtable_t* table = hash_alloc_opts(buckets, NULL, &opts);
+	int listen_fd = listen_on(path);
+	if (!table || listen_fd < 0) {
+		perror("hash_server");
+		return 1;
+	}
+
+	/*
+	 * the signals stay blocked except while the accepting thread waits in
+	 * ppoll, so none lands between the check of stopping and the wait
+	 */
+	struct sigaction action = { .sa_handler = on_signal };
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigset_t stop_signals, old_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+	struct worker_t* workers = calloc(nr_workers, sizeof(*workers));
+	int started = 0;
+	for (; workers && started < nr_workers; ++started) {
+		Worker worker = &workers[started];
+		worker->table = table;
+		worker->conns = NULL;
+		pthread_mutex_init(&worker->conns_lock, NULL);
+		if ((worker->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+			break;
+		if (pthread_create(&worker->thread, NULL, worker_routine, worker) != 0) {
+			close(worker->epfd);
+			break;
+		}
+	}
+	if (started < nr_workers) {
+		perror("hash_server");
+		stopping = 1;
+	}
+
+	int next = 0;
+	struct pollfd listen_poll = { .fd = listen_fd, .events = POLLIN };
+	while (!stopping) {
+		if (ppoll(&listen_poll, 1, NULL, &old_mask) < 0) {
+			if (errno != EINTR) {
+				perror("ppoll");
+				stopping = 1;
+			}
+			continue;
+		}
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			//out of descriptors: give the open connections time to close
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+					&& errno != ECONNABORTED) {
+				perror("accept");
+				usleep(STOP_POLL_MS * 1000);
+			}
+			continue;
+		}
+		if (conn_open(&workers[next], fd) < 0)
+			perror("hash_server");
+		next = (next + 1) % nr_workers;
+	}
+
+	for (int i = 0; i < started; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		while (workers[i].conns)
+			conn_close(&workers[i], workers[i].conns);
+		close(workers[i].epfd);
+		pthread_mutex_destroy(&workers[i].conns_lock);
+	}
+	free(workers);
+	close(listen_fd);
+	unlink(path);
+	hash_stop(table);
+	hash_free(table);
+	return 0;
+}